@@ -1,206 +1,447 @@
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "game.h"
 #include "mcts.h"
+#include "uct.h"
 #include "util.h"
 
+#define NO_NODE UINT32_MAX
+
+/* Nodes in all trees together: 20 MB, and as much again for the spares */
+#define MAX_NODES (1U << 20)
+
+/* Nodes refer to one another by their index in the arena, and the children
+ * of a node are allocated together when it is expanded.  The counters are
+ * updated atomically, as threads may share the tree.
+ */
 struct node {
-    int move;
+    uint32_t n_visits;
+    uint32_t score; /* In half points: 2 per win and 1 per draw */
+    uint32_t parent;
+    uint32_t children; /* Index of the first child */
+    uint8_t n_children;
+    uint8_t expanding;
+    int8_t move;
     char player;
-    int n_visits;
-    double score;
-    struct node *parent;
-    struct node *children[N_GRIDS];
 };
 
-static struct node *new_node(int move, char player, struct node *parent)
+/* Arena holding a tree, root first.  As moves are played the subtree of
+ * each is copied to the spare arena, which then takes over.
+ */
+struct tree {
+    struct node *nodes, *spare;
+    uint32_t n_nodes, max_nodes;
+    uint32_t cap;       /* The arena does not grow past this many nodes */
+    board_t root_board; /* Position at the root */
+    bool shared;        /* Searched by several threads: the arena is fixed */
+};
+
+/* One tree per thread for root parallelization, only the first otherwise */
+static struct tree trees[MCTS_MAX_THREADS];
+
+int mcts_threads = 1;
+int mcts_tree_parallel;
+int mcts_seed;
+
+/* xoshiro256** by David Blackman and Sebastiano Vigna, one per thread, see
+ * <https://prng.di.unimi.it/xoshiro256starstar.c>
+ */
+struct rng {
+    uint64_t s[4];
+};
+
+static inline uint64_t rotl(uint64_t x, int k)
 {
-    struct node *node = malloc(sizeof(struct node));
-    node->move = move;
-    node->player = player;
-    node->n_visits = 0;
-    node->score = 0;
-    node->parent = parent;
-    memset(node->children, 0, sizeof(node->children));
-    return node;
+    return (x << k) | (x >> (64 - k));
 }
 
-static void free_node(struct node *node)
+static inline uint64_t rng_next(struct rng *rng)
 {
-    for (int i = 0; i < N_GRIDS; i++)
-        if (node->children[i])
-            free_node(node->children[i]);
-    free(node);
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
 }
 
-static __uint64_t do_log(__uint64_t x)
+/* Uniform in [0, n), by Lemire's multiply-shift with rejection of the few
+ * values that would favour some results
+ */
+static inline uint32_t rng_below(struct rng *rng, uint32_t n)
 {
-    __uint64_t x_plus_1 = x + (1U << SHIFT_AMOUNT);
-    __uint64_t x_minus_1 = x - (1U << SHIFT_AMOUNT);
-    __uint64_t tmp1 = (x_minus_1 << SHIFT_AMOUNT) / x_plus_1;
-    __uint64_t tmp2 = (tmp1 * tmp1) >> SHIFT_AMOUNT;
-    __uint64_t result = 1U << SHIFT_AMOUNT;
-    for (__uint64_t i = 1; i < 10; i++) {
-        __uint64_t term =
-            (tmp2 << SHIFT_AMOUNT) / ((2 * i + 1) << SHIFT_AMOUNT);
-        result += term;
-        tmp2 = (tmp2 * tmp2) >> SHIFT_AMOUNT;
+    uint64_t m = (rng_next(rng) >> 32) * n;
+    if ((uint32_t) m < n) {
+        uint32_t threshold = -n % n;
+        while ((uint32_t) m < threshold)
+            m = (rng_next(rng) >> 32) * n;
     }
+    return m >> 32;
+}
 
-    result <<= 1;
-    result = (result * tmp1) >> SHIFT_AMOUNT;
-    return result;
+/* Fill the state from seed with splitmix64, which never gives all zeros */
+static void rng_seed(struct rng *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        rng->s[i] = z ^ (z >> 31);
+    }
 }
 
-static __uint64_t do_sqrt(__uint64_t x)
+/* Search state of a thread */
+struct search {
+    struct tree *tree;
+    const board_t *board;
+    char root_win;
+    int iterations;
+    uint64_t deadline; /* In microseconds, 0 for none */
+    struct rng rng;
+};
+
+/* Make room for n nodes in all, or as many as the cap and memory allow */
+static void reserve_nodes(struct tree *tree, uint32_t n)
 {
-    if (x <= 1)
-        return x;
+    if (n > tree->cap)
+        n = tree->cap;
+    if (n <= tree->max_nodes)
+        return;
+    uint32_t max = tree->max_nodes ? tree->max_nodes : ITERATIONS;
+    while (max < n)
+        max = max > tree->cap / 2 ? tree->cap : 2 * max;
+    if (max > tree->cap)
+        max = tree->cap;
 
-    __uint64_t high = x;
-    __uint64_t low = 0UL;
-    __uint64_t epsilon = 1UL << 10;
-    while ((high - low) > epsilon) {
-        __uint64_t mid = (low + high) / 2;
-        __uint64_t square = (mid * mid) >> 12;
-        if (square == x)
-            return mid;
-        else if (square < x)
-            low = mid;
-        else
-            high = mid;
+    /* Out of memory, the search goes on with the nodes it has */
+    struct node *nodes = realloc(tree->nodes, max * sizeof(struct node));
+    if (!nodes)
+        return;
+    tree->nodes = nodes;
+    struct node *spare = realloc(tree->spare, max * sizeof(struct node));
+    if (!spare)
+        return;
+    tree->spare = spare;
+    tree->max_nodes = max;
+}
+
+/* Allocate n consecutive nodes, returning the index of the first.  The
+ * arena grows, moving the nodes, unless it is shared.  NO_NODE is returned
+ * when the room reserved, or the cap, is used up.
+ */
+static uint32_t new_nodes(struct tree *tree, uint32_t n)
+{
+    if (!tree->shared)
+        reserve_nodes(tree, tree->n_nodes + n);
+    uint32_t first = __atomic_fetch_add(&tree->n_nodes, n, __ATOMIC_RELAXED);
+    if (first + n > tree->max_nodes) {
+        /* Threads sharing the tree may overshoot it together */
+        __atomic_fetch_sub(&tree->n_nodes, n, __ATOMIC_RELAXED);
+        return NO_NODE;
     }
-    return (low + high) / 2;
+    return first;
 }
 
-static inline double uct_score(__uint64_t n_total,
-                               __uint64_t n_visits,
-                               double score)
+static void init_node(struct tree *tree,
+                      uint32_t id,
+                      int move,
+                      char player,
+                      uint32_t parent)
 {
-    // printf("all %lu,visit %lu,score %lf\n",n_total,n_visits,score);
-    if (n_visits == 0)
-        return DBL_MAX;
-    __uint64_t fix_n_total = n_total * FIX_POINT_BIAS;
-    __uint64_t fix_n_visits = n_visits * FIX_POINT_BIAS;
-    __uint64_t fix_score = score * FIX_POINT_BIAS;
-    __uint64_t win = (fix_score * FIX_POINT_BIAS) / fix_n_visits;
-    __uint64_t tmpright1 =
-        (do_log(fix_n_total) * FIX_POINT_BIAS) / fix_n_visits;
-    __uint64_t tmpright2 = do_sqrt(tmpright1);
-    __uint64_t tmpleft = do_log(EXPLORATION_FACTOR * FIX_POINT_BIAS);
-    __uint64_t deep = (tmpright2 * tmpleft) / FIX_POINT_BIAS;
-    // printf("win :%lu tmpright1: %lu tmpright2: %lu tmpleft:
-    // %lu\n",win,tmpright1,tmpright2,tmpleft);
-    win += deep;
-    return (double) win / FIX_POINT_BIAS;
+    struct node *node = &tree->nodes[id];
+    node->n_visits = 0;
+    node->score = 0;
+    node->parent = parent;
+    node->n_children = 0;
+    node->expanding = 0;
+    node->move = move;
+    node->player = player;
 }
 
-static struct node *select_move(struct node *node)
+static uint32_t select_move(const struct tree *tree, const struct node *node)
 {
-    struct node *best_node = NULL;
+    const struct node *children = &tree->nodes[node->children];
+    uint32_t n_total = __atomic_load_n(&node->n_visits, __ATOMIC_RELAXED);
+    double exploration = uct_exploration(n_total);
     double best_score = -1;
-    for (int i = 0; i < N_GRIDS; i++) {
-        if (!node->children[i])
-            continue;
-        double score = uct_score(node->n_visits, node->children[i]->n_visits,
-                                 node->children[i]->score);
-        // printf("score : %f\n",score);
-        if (score > best_score) {
-            best_score = score;
-            best_node = node->children[i];
-        }
+    int best = -1;
+    for (int i = 0; i < node->n_children; i++) {
+        uint32_t n = __atomic_load_n(&children[i].n_visits, __ATOMIC_RELAXED);
+        uint32_t s = __atomic_load_n(&children[i].score, __ATOMIC_RELAXED);
+        double score = uct_score(exploration, n, s * 0.5);
+        bool better = score > best_score;
+        best = better ? i : best;
+        best_score = better ? score : best_score;
     }
-    return best_node;
+    return best < 0 ? NO_NODE : node->children + best;
 }
 
-static double simulate(char *table, char player)
+static double simulate(const board_t *board, char player, struct rng *rng)
 {
     char win;
     char current_player = player;
-    char temp_table[N_GRIDS];
-    memcpy(temp_table, table, N_GRIDS);
-    while (1) {
-        int *moves = available_moves(temp_table);
-        if (moves[0] == -1) {
-            free(moves);
-            break;
-        }
-        int n_moves = 0;
-        while (n_moves < N_GRIDS && moves[n_moves] != -1)
-            ++n_moves;
-        int move = moves[rand() % n_moves];
-        free(moves);
-        temp_table[move] = current_player;
-        if ((win = check_win(temp_table)) != ' ')
+    board_t b = *board;
+    int moves[MAX_GRIDS];
+    int n_moves = board_moves(board_empty(&b), moves);
+    while (n_moves) {
+        /* Take a random move out of the remaining ones */
+        int i = rng_below(rng, n_moves);
+        int move = moves[i];
+        moves[i] = moves[--n_moves];
+        board_play(&b, move, current_player);
+        if ((win = board_move_result(&b, move, current_player)) != ' ')
             return calculate_win_value(win, player);
         current_player ^= 'O' ^ 'X';
     }
     return 0.5;
 }
 
-static void backpropagate(struct node *node, double score)
+/* Add score, for the player who moved to node id, up to the root.  The
+ * visits were counted on the way down.
+ */
+static void backpropagate(struct tree *tree, uint32_t id, double score)
 {
-    while (node) {
-        node->n_visits++;
-        node->score += score;
-        node = node->parent;
-        score = 1 - score;
+    uint32_t half_points = score * 2;
+    while (id != NO_NODE) {
+        struct node *node = &tree->nodes[id];
+        __atomic_fetch_add(&node->score, half_points, __ATOMIC_RELAXED);
+        id = node->parent;
+        half_points = 2 - half_points;
     }
 }
 
-static void expand(struct node *node, char *table)
+/* Give node id its children, unless another thread does.  Return false if
+ * no room is left for them.
+ */
+static bool expand(struct tree *tree, uint32_t id, const board_t *b)
 {
-    int *moves = available_moves(table);
-    int n_moves = 0;
-    while (n_moves < N_GRIDS && moves[n_moves] != -1)
-        ++n_moves;
-    for (int i = 0; i < n_moves; i++) {
-        node->children[i] = new_node(moves[i], node->player ^ 'O' ^ 'X', node);
+    struct node *node = &tree->nodes[id];
+    if (__atomic_exchange_n(&node->expanding, 1, __ATOMIC_ACQUIRE)) {
+        /* Wait for the children another thread is setting up */
+        while (!__atomic_load_n(&node->n_children, __ATOMIC_ACQUIRE)) {
+            if (!__atomic_load_n(&node->expanding, __ATOMIC_ACQUIRE))
+                return false;
+        }
+        return true;
+    }
+    int moves[MAX_GRIDS];
+    int n_moves = board_moves(board_empty(b), moves);
+    uint32_t children = new_nodes(tree, n_moves);
+    if (children == NO_NODE) {
+        __atomic_store_n(&node->expanding, 0, __ATOMIC_RELEASE);
+        return false;
     }
-    free(moves);
+    node = &tree->nodes[id]; /* The arena may have moved */
+    char player = node->player ^ 'O' ^ 'X';
+    for (int i = 0; i < n_moves; i++)
+        init_node(tree, children + i, moves[i], player, id);
+    node->children = children;
+    __atomic_store_n(&node->n_children, n_moves, __ATOMIC_RELEASE);
+    return true;
 }
 
-int mcts(char *table, char player)
+/* Playouts from the root of the tree.  Threads sharing a tree see the nodes
+ * along one another's paths as visited but not yet won, a virtual loss
+ * steering them apart.
+ */
+static void *search(void *arg)
 {
-    char win;
-    struct node *root = new_node(-1, player, NULL);
-    for (int i = 0; i < ITERATIONS; i++) {
-        struct node *node = root;
-        char temp_table[N_GRIDS];
-        memcpy(temp_table, table, N_GRIDS);
+    struct search *s = arg;
+    struct tree *tree = s->tree;
+    for (int i = 0; i < s->iterations; i++) {
+        /* Look at the clock every few playouts */
+        if (s->deadline && !(i % 16) && now_usec() >= s->deadline)
+            break;
+        uint32_t id = 0;
+        board_t b = *s->board;
         while (1) {
-            if ((win = check_win(temp_table)) != ' ') {
-                double score =
-                    calculate_win_value(win, node->player ^ 'O' ^ 'X');
-                backpropagate(node, score);
+            struct node *node = &tree->nodes[id];
+            uint32_t visits =
+                __atomic_fetch_add(&node->n_visits, 1, __ATOMIC_RELAXED);
+            char player = node->player, last = player ^ 'O' ^ 'X';
+            char win = id == 0 ? s->root_win
+                               : board_move_result(&b, node->move, last);
+            if (win != ' ') {
+                backpropagate(tree, id, calculate_win_value(win, last));
                 break;
             }
-            if (node->n_visits == 0) {
-                double score = simulate(temp_table, node->player);
-                backpropagate(node, score);
+            if (visits == 0 ||
+                (!__atomic_load_n(&node->n_children, __ATOMIC_ACQUIRE) &&
+                 !expand(tree, id, &b))) {
+                backpropagate(tree, id, simulate(&b, player, &s->rng));
                 break;
             }
-            if (node->children[0] == NULL)
-                expand(node, temp_table);
-            node = select_move(node);
-            assert(node);
-            temp_table[node->move] = node->player ^ 'O' ^ 'X';
+            /* Expanding may have moved the arena */
+            id = select_move(tree, &tree->nodes[id]);
+            assert(id != NO_NODE);
+            board_play(&b, tree->nodes[id].move, last ^ 'O' ^ 'X');
         }
     }
-    struct node *best_node = NULL;
-    int most_visits = -1;
-    for (int i = 0; i < N_GRIDS; i++) {
-        if (root->children[i] && root->children[i]->n_visits > most_visits) {
-            most_visits = root->children[i]->n_visits;
-            best_node = root->children[i];
+    return NULL;
+}
+
+/* Make the subtree of node id the tree, copying it breadth first so that
+ * the children of each node stay together
+ */
+static void reroot(struct tree *tree, uint32_t id)
+{
+    struct node *nodes = tree->nodes, *spare = tree->spare;
+    uint32_t n = 0;
+    spare[n] = nodes[id];
+    spare[n++].parent = NO_NODE;
+    for (uint32_t i = 0; i < n; i++) {
+        struct node *node = &spare[i];
+        if (!node->n_children)
+            continue;
+        memcpy(&spare[n], &nodes[node->children],
+               node->n_children * sizeof(struct node));
+        node->children = n;
+        for (int k = 0; k < node->n_children; k++)
+            spare[n++].parent = i;
+    }
+    tree->nodes = spare;
+    tree->spare = nodes;
+    tree->n_nodes = n;
+}
+
+void mcts_play(int move)
+{
+    for (int t = 0; t < MCTS_MAX_THREADS; t++) {
+        struct tree *tree = &trees[t];
+        if (!tree->n_nodes)
+            continue;
+        const struct node *root = &tree->nodes[0];
+        uint32_t id = NO_NODE;
+        for (int i = 0; i < root->n_children; i++) {
+            if (tree->nodes[root->children + i].move == move)
+                id = root->children + i;
         }
+        if (id == NO_NODE) {
+            tree->n_nodes = 0;
+            continue;
+        }
+        board_play(&tree->root_board, move, root->player);
+        reroot(tree, id);
+    }
+}
+
+/* Get tree ready to search board, by several threads if shared, in an
+ * arena of at most cap nodes.  Return false if there is no room for a root.
+ */
+static bool prepare_tree(struct tree *tree,
+                         const board_t *board,
+                         char player,
+                         bool shared,
+                         uint32_t cap)
+{
+    tree->shared = false;
+    tree->cap = cap;
+    if (!tree->n_nodes || tree->nodes[0].player != player ||
+        memcmp(board, &tree->root_board, sizeof(*board))) {
+        /* Not where the last search and the moves played since lead */
+        tree->n_nodes = 0;
+        uint32_t root = new_nodes(tree, 1);
+        if (root == NO_NODE)
+            return false;
+        init_node(tree, root, -1, player, NO_NODE);
+        tree->root_board = *board;
+    }
+    /* Room for ITERATIONS playouts, each expanding a node at most unless
+     * racing with others.  A longer search goes on without expanding.
+     */
+    if (shared)
+        reserve_nodes(tree, tree->n_nodes + ITERATIONS * N_GRIDS);
+    tree->shared = shared;
+    return true;
+}
+
+void mcts_free(void)
+{
+    for (int t = 0; t < MCTS_MAX_THREADS; t++) {
+        free(trees[t].nodes);
+        free(trees[t].spare);
+        trees[t] = (struct tree){0};
+    }
+}
+
+int mcts(char *table, char player, int budget_us)
+{
+    uint64_t deadline = budget_us > 0 ? now_usec() + budget_us : 0;
+    uct_init();
+    board_t board;
+    board_from_table(&board, table);
+    char root_win = board_check_win(&board);
+
+    int n_threads = mcts_threads < 1                  ? 1
+                    : mcts_threads > MCTS_MAX_THREADS ? MCTS_MAX_THREADS
+                                                      : mcts_threads;
+    int n_trees = mcts_tree_parallel ? 1 : n_threads;
+    /* The same seed and position give the same streams */
+    uint64_t seed = mcts_seed ? (uint64_t) mcts_seed : (uint64_t) rand();
+    seed ^= board.mask[0] * 0x9e3779b97f4a7c15ULL ^ board.mask[1];
+    struct search searches[MCTS_MAX_THREADS];
+    for (int t = 0; t < n_threads; t++) {
+        struct search *s = &searches[t];
+        s->tree = &trees[mcts_tree_parallel ? 0 : t];
+        s->board = &board;
+        s->root_win = root_win;
+        s->iterations = deadline ? INT_MAX
+                                 : ITERATIONS / n_threads +
+                                       (t < ITERATIONS % n_threads);
+        s->deadline = deadline;
+        rng_seed(&s->rng, seed + t * 0x632be59bd9b4e019ULL);
+    }
+    bool ready[MCTS_MAX_THREADS];
+    for (int t = 0; t < n_trees; t++)
+        ready[t] = prepare_tree(&trees[t], &board, player, mcts_tree_parallel,
+                                MAX_NODES / n_trees);
+    /* Threads without a tree to search sit this move out */
+    for (int t = 0; t < n_threads; t++) {
+        if (!ready[mcts_tree_parallel ? 0 : t])
+            searches[t].iterations = 0;
+    }
+
+    pthread_t threads[MCTS_MAX_THREADS];
+    bool started[MCTS_MAX_THREADS] = {false};
+    for (int t = 1; t < n_threads; t++)
+        started[t] = !pthread_create(&threads[t], NULL, search, &searches[t]);
+    search(&searches[0]);
+    for (int t = 1; t < n_threads; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            search(&searches[t]);
+    }
+
+    /* The move most visited over all trees */
+    uint32_t visits[MAX_GRIDS] = {0};
+    for (int t = 0; t < n_trees; t++) {
+        if (!ready[t])
+            continue;
+        const struct node *root = &trees[t].nodes[0];
+        for (int i = 0; i < root->n_children; i++) {
+            const struct node *child = &trees[t].nodes[root->children + i];
+            visits[child->move] += child->n_visits;
+        }
+    }
+    int best_move = -1;
+    for (int move = 0; move < N_GRIDS; move++) {
+        if (board_empty(&board) >> move & 1 &&
+            (best_move < 0 || visits[move] > visits[best_move]))
+            best_move = move;
     }
-    int best_move = best_node->move;
-    free_node(root);
     return best_move;
 }
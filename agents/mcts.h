@@ -4,7 +4,30 @@
 
 #define EXPLORATION_FACTOR 2.0
 
-#define SHIFT_AMOUNT 16
-#define FIX_POINT_BIAS (1 << SHIFT_AMOUNT)
+#define MCTS_MAX_THREADS 64
 
-int mcts(char *table, char player);
+/* Threads searching each move, ITERATIONS playouts in all.  Unless
+ * mcts_tree_parallel is set, each grows a tree of its own and their visits
+ * are added up in the end; otherwise they share one tree.
+ */
+extern int mcts_threads;
+extern int mcts_tree_parallel;
+
+/* Seed of the playouts, 0 for a random one on every search.  Set, a game
+ * of single-threaded searches without a time budget plays out the same
+ * way each time.
+ */
+extern int mcts_seed;
+
+/* Best move for player on table, after ITERATIONS playouts or, if budget_us
+ * is positive, as many as fit in that many microseconds.  The tree searched
+ * is kept, and extended by the next search if every move played meanwhile
+ * went through mcts_play().
+ */
+int mcts(char *table, char player, int budget_us);
+
+/* Keep the part of the tree below move, played from the searched position */
+void mcts_play(int move);
+
+/* Free the trees kept between searches */
+void mcts_free(void);
@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,11 +14,21 @@
 
 #define MAX_SEARCH_DEPTH 6
 
-static int history_score_sum[N_GRIDS];
-static int history_count[N_GRIDS];
+static int history_score_sum[MAX_GRIDS];
+static int history_count[MAX_GRIDS];
 
 static uint64_t hash_value;
 
+/* Position searched, updated along with hash_value as moves are tried */
+static board_t board;
+
+/* Time the search must end by, in microseconds, 0 for none.  Once it has
+ * passed, the search unwinds without a result.
+ */
+static uint64_t deadline;
+static bool timed_out;
+static unsigned n_searched;
+
 static int cmp_moves(const void *a, const void *b)
 {
     int *_a = (int *) a, *_b = (int *) b;
@@ -29,10 +41,26 @@ static int cmp_moves(const void *a, const void *b)
     return score_b - score_a;
 }
 
-static move_t negamax(char *table, int depth, char player, int alpha, int beta)
+/* Search the position reached by the opponent of player marking last_move,
+ * or the one negamax_predict() was given when last_move is -1
+ */
+static move_t negamax(int last_move,
+                      int depth,
+                      char player,
+                      int alpha,
+                      int beta)
 {
-    if (check_win(table) != ' ' || depth == 0) {
-        move_t result = {get_score(table, player), -1};
+    /* Look at the clock every few positions */
+    if (deadline && !(++n_searched % 256) && now_usec() >= deadline)
+        timed_out = true;
+    if (timed_out)
+        return (move_t){0, -1};
+
+    char win = last_move < 0
+                   ? board_check_win(&board)
+                   : board_move_result(&board, last_move, player ^ 'O' ^ 'X');
+    if (win != ' ' || depth == 0) {
+        move_t result = {board_score(&board, player), -1};
         return result;
     }
     zobrist_entry_t *entry = zobrist_get(hash_value);
@@ -40,28 +68,27 @@ static move_t negamax(char *table, int depth, char player, int alpha, int beta)
         return (move_t){.score = entry->score, .move = entry->move};
 
     int score;
-    move_t best_move = {-10000, -1};
-    int *moves = available_moves(table);
-    int n_moves = 0;
-    while (n_moves < N_GRIDS && moves[n_moves] != -1)
-        ++n_moves;
+    move_t best_move = {-INT_MAX, -1};
+    int moves[MAX_GRIDS];
+    int n_moves = board_moves(board_empty(&board), moves);
     qsort(moves, n_moves, sizeof(int), cmp_moves);
     for (int i = 0; i < n_moves; i++) {
-        table[moves[i]] = player;
+        board_play(&board, moves[i], player);
         hash_value ^= zobrist_table[moves[i]][player == 'X'];
         if (!i)  // do a full search on the first move
-            score = -negamax(table, depth - 1, player == 'X' ? 'O' : 'X', -beta,
-                             -alpha)
+            score = -negamax(moves[i], depth - 1, player == 'X' ? 'O' : 'X',
+                             -beta, -alpha)
                          .score;
         else {
             // do a null-window search on the rest of the moves
-            score = -negamax(table, depth - 1, player == 'X' ? 'O' : 'X',
+            score = -negamax(moves[i], depth - 1, player == 'X' ? 'O' : 'X',
                              -alpha - 1, -alpha)
                          .score;
             if (alpha < score && score < beta)  // do a full re-search
-                score = -negamax(table, depth - 1, player == 'X' ? 'O' : 'X',
-                                 -beta, -score)
-                             .score;
+                score =
+                    -negamax(moves[i], depth - 1, player == 'X' ? 'O' : 'X',
+                             -beta, -score)
+                         .score;
         }
         history_count[moves[i]]++;
         history_score_sum[moves[i]] += score;
@@ -69,15 +96,16 @@ static move_t negamax(char *table, int depth, char player, int alpha, int beta)
             best_move.score = score;
             best_move.move = moves[i];
         }
-        table[moves[i]] = ' ';
+        board_undo(&board, moves[i], player);
         hash_value ^= zobrist_table[moves[i]][player == 'X'];
+        if (timed_out)
+            return best_move;
         if (score > alpha)
             alpha = score;
         if (alpha >= beta)
             break;
     }
 
-    free((char *) moves);
     zobrist_put(hash_value, best_move.score, best_move.move);
     return best_move;
 }
@@ -88,14 +116,33 @@ void negamax_init()
     hash_value = 0;
 }
 
-move_t negamax_predict(char *table, char player)
+move_t negamax_predict(char *table, char player, int budget_us)
 {
+    uint64_t end = budget_us > 0 ? now_usec() + budget_us : 0;
     memset(history_score_sum, 0, sizeof(history_score_sum));
     memset(history_count, 0, sizeof(history_count));
-    move_t result;
-    for (int depth = 2; depth <= MAX_SEARCH_DEPTH; depth += 2) {
-        result = negamax(table, depth, player, -100000, 100000);
+    board_from_table(&board, table);
+    /* The first legal move, unless a search gets to pick one */
+    int moves[MAX_GRIDS];
+    int n_moves = board_moves(board_empty(&board), moves);
+    move_t result = {board_score(&board, player), n_moves ? moves[0] : -1};
+    /* With a budget, deepen until it runs out or the game is searched to
+     * its end
+     */
+    int max_depth =
+        end ? __builtin_popcountll(board_empty(&board)) + 1 : MAX_SEARCH_DEPTH;
+    deadline = 0;
+    timed_out = false;
+    for (int depth = 2; depth <= max_depth; depth += 2) {
+        move_t move = negamax(-1, depth, player, -INT_MAX, INT_MAX);
         zobrist_clear();
+        if (timed_out)
+            break;
+        result = move;
+        /* There is a move to return once the first depth is searched */
+        deadline = end;
+        if (end && now_usec() >= end)
+            break;
     }
     return result;
 }
\ No newline at end of file
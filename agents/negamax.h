@@ -5,4 +5,7 @@ typedef struct {
 } move_t;
 
 void negamax_init();
-move_t negamax_predict(char *table, char player);
+/* Best move for player on table, searched a fixed number of plies deep or, if
+ * budget_us is positive, as deep as that many microseconds allow
+ */
+move_t negamax_predict(char *table, char player, int budget_us);
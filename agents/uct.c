@@ -0,0 +1,24 @@
+#include <math.h>
+#include <stdbool.h>
+
+#include "mcts.h"
+#include "uct.h"
+
+float uct_log_table[UCT_TABLE_SIZE];
+float uct_rsqrt_table[UCT_TABLE_SIZE];
+double uct_c;
+
+void uct_init(void)
+{
+    static bool ready;
+    if (ready)
+        return;
+    ready = true;
+    /* Neither is used for no visits */
+    uct_log_table[0] = uct_rsqrt_table[0] = 0;
+    for (int n = 1; n < UCT_TABLE_SIZE; n++) {
+        uct_log_table[n] = log(n);
+        uct_rsqrt_table[n] = 1 / sqrt(n);
+    }
+    uct_c = log(EXPLORATION_FACTOR);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+/* UCT scoring for MCTS.  A child visited n times, out of n_total visits of
+ * its parent, with score total score, is worth
+ *
+ *   score / n + c * sqrt(ln(n_total) / n),  c = ln(EXPLORATION_FACTOR)
+ *
+ * The exploration term is split into c * sqrt(ln(n_total)), computed once
+ * for all the children of a node by uct_exploration(), and 1 / sqrt(n),
+ * which also gives 1 / n.  Both ln and 1 / sqrt are looked up for visit
+ * counts below UCT_TABLE_SIZE.
+ */
+
+#define UCT_TABLE_SIZE 4096
+
+extern float uct_log_table[UCT_TABLE_SIZE];
+extern float uct_rsqrt_table[UCT_TABLE_SIZE];
+extern double uct_c;
+
+/* Fill the tables, once before the first use of what follows */
+void uct_init(void);
+
+static inline double uct_log(uint32_t n)
+{
+    return n < UCT_TABLE_SIZE ? uct_log_table[n] : log(n);
+}
+
+static inline double uct_rsqrt(uint32_t n)
+{
+    return n < UCT_TABLE_SIZE ? uct_rsqrt_table[n] : 1 / sqrt(n);
+}
+
+static inline double uct_exploration(uint32_t n_total)
+{
+    return uct_c * sqrt(uct_log(n_total));
+}
+
+/* Unvisited children come first */
+static inline double uct_score(double exploration,
+                               uint32_t n_visits,
+                               double score)
+{
+    double r = uct_rsqrt(n_visits);
+    return n_visits ? (score * r + exploration) * r : DBL_MAX;
+}
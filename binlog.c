@@ -0,0 +1,369 @@
+/* Binary event log of interpreted commands, and its offline analysis */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binlog.h"
+#include "report.h"
+
+/* Record types */
+enum {
+    REC_NAME = 1, /* u8 type, u16 id, u16 len, name */
+    REC_CMD = 2,  /* see CMD_HEADER_SIZE */
+};
+
+/* u8 type, u8 ok, u16 id, u16 argc, u64 start, u64 duration, i32 qsize,
+ * i64 block delta.  Followed by argc - 1 arguments, each as u16 len + bytes.
+ */
+#define CMD_HEADER_SIZE 34
+
+/* Most distinct commands one log can describe */
+#define MAX_IDS 256
+
+/* Histogram buckets: bucket k counts durations in [2^k, 2^(k+1)) ns */
+#define N_BUCKETS 48
+
+static FILE *logfp = NULL;
+static uint64_t origin_ns;
+static binlog_probe_t probe_fun = NULL;
+
+/* Command names seen so far, hashed by address */
+static const char *id_name[MAX_IDS];
+static uint16_t id_slot[MAX_IDS];
+static int n_ids = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    return put_u16(put_u16(p, v & 0xffff), v >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (v >> (8 * i)) & 0xff;
+    return p + 8;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+bool binlog_open(const char *file_name)
+{
+    binlog_close();
+
+    logfp = fopen(file_name, "wb");
+    if (!logfp)
+        return false;
+
+    uint8_t header[8];
+    memcpy(header, BINLOG_MAGIC, 4);
+    put_u16(header + 4, BINLOG_VERSION);
+    put_u16(header + 6, 0);
+    fwrite(header, 1, sizeof(header), logfp);
+
+    memset(id_name, 0, sizeof(id_name));
+    n_ids = 0;
+    origin_ns = now_ns();
+    return true;
+}
+
+void binlog_close(void)
+{
+    if (!logfp)
+        return;
+    fclose(logfp);
+    logfp = NULL;
+}
+
+bool binlog_active(void)
+{
+    return logfp != NULL;
+}
+
+void binlog_set_probe(binlog_probe_t probe)
+{
+    probe_fun = probe;
+}
+
+void binlog_begin(binlog_mark_t *mark)
+{
+    int qsize = -1;
+    mark->blocks = 0;
+    if (probe_fun)
+        probe_fun(&qsize, &mark->blocks);
+    mark->start_ns = now_ns();
+}
+
+/* Map a registered command name to its id, emitting a name record when the
+ * command shows up for the first time.  Return -1 when the table is full.
+ */
+static int lookup_id(const char *name)
+{
+    unsigned h = ((uintptr_t) name >> 3) % MAX_IDS;
+    while (id_name[h]) {
+        if (id_name[h] == name)
+            return id_slot[h];
+        h = (h + 1) % MAX_IDS;
+    }
+
+    /* Keep the table at most half full so probing stays short */
+    if (n_ids >= MAX_IDS / 2)
+        return -1;
+
+    size_t len = strlen(name);
+    uint8_t rec[5];
+    rec[0] = REC_NAME;
+    put_u16(rec + 1, n_ids);
+    put_u16(rec + 3, len);
+    fwrite(rec, 1, sizeof(rec), logfp);
+    fwrite(name, 1, len, logfp);
+
+    id_name[h] = name;
+    id_slot[h] = n_ids;
+    return n_ids++;
+}
+
+void binlog_end(const binlog_mark_t *mark,
+                const char *name,
+                int argc,
+                char *argv[],
+                bool ok)
+{
+    uint64_t end_ns = now_ns();
+    /* The log may have been (re)opened by this very command */
+    if (!logfp || mark->start_ns < origin_ns)
+        return;
+
+    int qsize = -1;
+    long blocks = 0;
+    if (probe_fun)
+        probe_fun(&qsize, &blocks);
+
+    int id = lookup_id(name);
+    if (id < 0)
+        return;
+
+    uint8_t rec[CMD_HEADER_SIZE];
+    uint8_t *p = rec;
+    *p++ = REC_CMD;
+    *p++ = ok;
+    p = put_u16(p, id);
+    p = put_u16(p, argc);
+    p = put_u64(p, mark->start_ns - origin_ns);
+    p = put_u64(p, end_ns - mark->start_ns);
+    p = put_u32(p, (uint32_t) qsize);
+    put_u64(p, (uint64_t) (blocks - mark->blocks));
+    fwrite(rec, 1, sizeof(rec), logfp);
+
+    for (int i = 1; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        if (len > UINT16_MAX)
+            len = UINT16_MAX;
+        uint8_t lenbuf[2];
+        put_u16(lenbuf, len);
+        fwrite(lenbuf, 1, sizeof(lenbuf), logfp);
+        fwrite(argv[i], 1, len, logfp);
+    }
+}
+
+/* Analysis */
+
+typedef struct {
+    char *name;
+    size_t name_len; /* Without the terminating NUL */
+    uint64_t count, failed;
+    uint64_t total_ns, min_ns, max_ns;
+    int64_t blocks;
+    uint64_t hist[N_BUCKETS];
+} cmd_stat_t;
+
+static int bucket_of(uint64_t ns)
+{
+    int k = 0;
+    while (ns > 1 && k < N_BUCKETS - 1) {
+        ns >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/* Render a duration with a readable unit */
+static void format_ns(char *buf, size_t len, double ns)
+{
+    if (ns < 1e3)
+        snprintf(buf, len, "%.0f ns", ns);
+    else if (ns < 1e6)
+        snprintf(buf, len, "%.3f us", ns / 1e3);
+    else if (ns < 1e9)
+        snprintf(buf, len, "%.3f ms", ns / 1e6);
+    else
+        snprintf(buf, len, "%.3f s", ns / 1e9);
+}
+
+/* Upper bound of the bucket holding the q-quantile */
+static uint64_t hist_quantile(const cmd_stat_t *st, double q)
+{
+    uint64_t want = (uint64_t) (q * st->count + 0.5);
+    uint64_t seen = 0;
+    for (int k = 0; k < N_BUCKETS; k++) {
+        seen += st->hist[k];
+        if (seen >= want && seen) {
+            uint64_t bound = 2ULL << k;
+            return bound < st->max_ns ? bound : st->max_ns;
+        }
+    }
+    return st->max_ns;
+}
+
+static void print_stat(const cmd_stat_t *st)
+{
+    char min[32], mean[32], p50[32], p99[32], max[32];
+    format_ns(min, sizeof(min), st->min_ns);
+    format_ns(mean, sizeof(mean), (double) st->total_ns / st->count);
+    format_ns(p50, sizeof(p50), hist_quantile(st, 0.50));
+    format_ns(p99, sizeof(p99), hist_quantile(st, 0.99));
+    format_ns(max, sizeof(max), st->max_ns);
+
+    report(1, "%-12s count %lu, failed %lu, blocks %+ld", st->name,
+           (unsigned long) st->count, (unsigned long) st->failed,
+           (long) st->blocks);
+    report(1, "  min %s, mean %s, p50 <= %s, p99 <= %s, max %s", min, mean,
+           p50, p99, max);
+
+    uint64_t peak = 0;
+    for (int k = 0; k < N_BUCKETS; k++)
+        if (st->hist[k] > peak)
+            peak = st->hist[k];
+
+    for (int k = 0; k < N_BUCKETS; k++) {
+        if (!st->hist[k])
+            continue;
+        char lo[32], hi[32], bar[41];
+        format_ns(lo, sizeof(lo), (double) (1ULL << k));
+        format_ns(hi, sizeof(hi), (double) (2ULL << k));
+        int width = (int) ((st->hist[k] * 40 + peak - 1) / peak);
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        report(1, "  [%10s, %10s) %-40s %lu", lo, hi, bar,
+               (unsigned long) st->hist[k]);
+    }
+}
+
+bool binlog_analyze(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp)
+        return false;
+
+    bool ok = true;
+    uint8_t header[8];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, BINLOG_MAGIC, 4) ||
+        get_u16(header + 4) != BINLOG_VERSION) {
+        report(1, "'%s' is not a version %d binary log", file_name,
+               BINLOG_VERSION);
+        fclose(fp);
+        return false;
+    }
+
+    cmd_stat_t *stats = calloc_or_fail(MAX_IDS, sizeof(cmd_stat_t),
+                                       "binlog_analyze");
+    int type;
+    while (ok && (type = fgetc(fp)) != EOF) {
+        if (type == REC_NAME) {
+            uint8_t rec[4];
+            if (fread(rec, 1, sizeof(rec), fp) != sizeof(rec)) {
+                ok = false;
+                break;
+            }
+            uint16_t id = get_u16(rec), len = get_u16(rec + 2);
+            if (id >= MAX_IDS || stats[id].name) {
+                ok = false;
+                break;
+            }
+            char *name = malloc_or_fail(len + 1, "binlog_analyze");
+            name[len] = '\0';
+            stats[id].name = name;
+            stats[id].name_len = len;
+            stats[id].min_ns = UINT64_MAX;
+            /* Names are written with strlen, so a NUL means corruption */
+            ok = fread(name, 1, len, fp) == len && !memchr(name, '\0', len);
+        } else if (type == REC_CMD) {
+            uint8_t rec[CMD_HEADER_SIZE];
+            if (fread(rec + 1, 1, CMD_HEADER_SIZE - 1, fp) !=
+                CMD_HEADER_SIZE - 1) {
+                ok = false;
+                break;
+            }
+            uint16_t id = get_u16(rec + 2), argc = get_u16(rec + 4);
+            uint64_t duration = get_u64(rec + 14);
+            int64_t blocks = (int64_t) get_u64(rec + 26);
+            if (id >= MAX_IDS || !stats[id].name) {
+                ok = false;
+                break;
+            }
+
+            cmd_stat_t *st = &stats[id];
+            st->count++;
+            st->failed += !rec[1];
+            st->total_ns += duration;
+            st->blocks += blocks;
+            if (duration < st->min_ns)
+                st->min_ns = duration;
+            if (duration > st->max_ns)
+                st->max_ns = duration;
+            st->hist[bucket_of(duration)]++;
+
+            /* Arguments are kept for replay but not needed for timing */
+            for (int i = 1; ok && i < argc; i++) {
+                uint8_t lenbuf[2];
+                ok = fread(lenbuf, 1, sizeof(lenbuf), fp) == sizeof(lenbuf) &&
+                     fseek(fp, get_u16(lenbuf), SEEK_CUR) == 0;
+            }
+        } else {
+            ok = false;
+        }
+    }
+    fclose(fp);
+
+    if (!ok)
+        report(1, "Binary log '%s' is truncated or corrupted", file_name);
+
+    for (int id = 0; id < MAX_IDS; id++) {
+        if (!stats[id].name)
+            continue;
+        if (stats[id].count)
+            print_stat(&stats[id]);
+        free_block(stats[id].name, stats[id].name_len + 1);
+    }
+    free_array(stats, MAX_IDS, sizeof(cmd_stat_t));
+
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef LAB0_BINLOG_H
+#define LAB0_BINLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Compact binary record of every command executed by the interpreter.
+ *
+ * The file starts with a header (magic "QTBL" and a version), followed by a
+ * stream of records.  A name record maps a small command id to the command
+ * name the first time that command is seen; every command record carries
+ * that id, its arguments, a start timestamp, the duration, the queue size
+ * after the command and the change in allocated blocks.  Timing histograms
+ * can then be rebuilt from the file without rerunning the trace.
+ */
+
+#define BINLOG_MAGIC "QTBL"
+#define BINLOG_VERSION 1
+
+/* Sample application state around each command.  Values that are unknown
+ * may be left untouched (they default to -1 and 0 respectively).
+ */
+typedef void (*binlog_probe_t)(int *qsize, long *blocks);
+
+/* State captured when a command starts */
+typedef struct {
+    uint64_t start_ns;
+    long blocks;
+} binlog_mark_t;
+
+/* Start writing a new binary log, replacing any log already open */
+bool binlog_open(const char *file_name);
+
+/* Flush and close the current binary log, if any */
+void binlog_close(void);
+
+/* Is a binary log currently being written? */
+bool binlog_active(void);
+
+/* Install function used to sample queue size and allocated blocks */
+void binlog_set_probe(binlog_probe_t probe);
+
+/* Bracket the execution of a command.  The name must be the command's
+ * registered name, which stays valid (and at the same address) for the whole
+ * session.
+ */
+void binlog_begin(binlog_mark_t *mark);
+void binlog_end(const binlog_mark_t *mark,
+                const char *name,
+                int argc,
+                char *argv[],
+                bool ok);
+
+/* Print per-command timing statistics and histograms of a binary log */
+bool binlog_analyze(const char *file_name);
+
+#endif /* LAB0_BINLOG_H */
@@ -9,8 +9,10 @@
 #include <string.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "binlog.h"
 #include "console.h"
 #include "report.h"
 #include "web.h"
@@ -31,20 +33,44 @@ static double first_time, last_time;
 
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ *
+ * Input is read in large blocks and lines are handed out in place: the
+ * newline is overwritten with a null character and the caller gets a
+ * pointer into the buffer, valid until the next call to readline().
  */
 
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 65536
 
 typedef struct __rio {
-    int fd;                /* File descriptor */
-    int count;             /* Unread bytes in internal buffer */
-    char *bufptr;          /* Next unread byte in internal buffer */
-    char buf[RIO_BUFSIZE]; /* Internal buffer */
-    struct __rio *prev;    /* Next element in stack */
+    int fd;                    /* File descriptor */
+    int count;                 /* Unread bytes in internal buffer */
+    char *bufptr;              /* Next unread byte in internal buffer */
+    char buf[RIO_BUFSIZE + 1]; /* Internal buffer, plus room for a null */
+    struct __rio *prev;        /* Next element in stack */
 } rio_t;
 
 static rio_t *buf_stack;
-static char linebuf[RIO_BUFSIZE];
+
+/* Commands recorded between 'repeat n' and 'end', parsed once */
+typedef struct {
+    int argc;
+    char **argv;
+} saved_cmd_t;
+
+static saved_cmd_t *block_cmds = NULL;
+static int block_len = 0;
+static int block_cap = 0;
+static int block_depth = 0; /* Nesting depth while recording a block */
+static int block_reps = 0;
+static bool block_failed = false; /* A nested repeat count was invalid */
+/* Input the block is read from: a file, or the console and a web client */
+static rio_t *block_rio = NULL;
+static unsigned long block_client = 0;
+static int repeat_level = 0; /* Nesting depth of executing repeats */
+
+/* Argument vector reused by every parsed command line */
+static char **argv_vec = NULL;
+static int argv_cap = 0;
 
 /* Maximum file descriptor */
 static int fd_max = 0;
@@ -65,6 +91,36 @@ static bool has_infile = false;
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+/* Commands and parameters are also indexed by name for dispatch.
+ * Open addressing with linear probing; capacity is a power of two and the
+ * table is kept at most half full.
+ */
+#define NAME_TABLE_INIT 64
+
+typedef struct {
+    const char *name;
+    void *elem;
+} name_slot_t;
+
+typedef struct {
+    name_slot_t *slots;
+    size_t capacity;
+    size_t count;
+} name_table_t;
+
+static name_table_t cmd_table;
+static name_table_t param_table;
+
+/* Names sorted alphabetically, rebuilt lazily for prefix completion */
+typedef struct {
+    const char **names;
+    size_t count;
+    bool dirty;
+} name_index_t;
+
+static name_index_t cmd_index;
+static name_index_t param_index;
+
 static void init_in();
 
 static bool push_file(char *fname);
@@ -72,6 +128,125 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* FNV-1a */
+static size_t name_hash(const char *name)
+{
+    size_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static name_slot_t *name_table_slot(const name_table_t *t, const char *name)
+{
+    size_t i = name_hash(name) & (t->capacity - 1);
+    while (t->slots[i].name && strcmp(t->slots[i].name, name))
+        i = (i + 1) & (t->capacity - 1);
+    return &t->slots[i];
+}
+
+static void *name_table_find(const name_table_t *t, const char *name)
+{
+    if (!t->count)
+        return NULL;
+    return name_table_slot(t, name)->elem;
+}
+
+static void name_table_free(name_table_t *t)
+{
+    if (t->slots)
+        free_array(t->slots, t->capacity, sizeof(name_slot_t));
+    t->slots = NULL;
+    t->capacity = t->count = 0;
+}
+
+/* Insert or replace the element registered under name */
+static void name_table_insert(name_table_t *t, const char *name, void *elem)
+{
+    if (2 * (t->count + 1) > t->capacity) {
+        name_table_t bigger = {
+            .capacity = t->capacity ? 2 * t->capacity : NAME_TABLE_INIT,
+        };
+        bigger.slots = calloc_or_fail(bigger.capacity, sizeof(name_slot_t),
+                                      "name_table_insert");
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].name) {
+                *name_table_slot(&bigger, t->slots[i].name) = t->slots[i];
+                bigger.count++;
+            }
+        }
+        name_table_free(t);
+        *t = bigger;
+    }
+
+    name_slot_t *slot = name_table_slot(t, name);
+    if (!slot->name)
+        t->count++;
+    slot->name = name;
+    slot->elem = elem;
+}
+
+static void name_index_free(name_index_t *idx)
+{
+    if (idx->names)
+        free_array(idx->names, idx->count, sizeof(char *));
+    idx->names = NULL;
+    idx->count = 0;
+    idx->dirty = true;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/* Rebuild the sorted name array from a hash table if it is out of date */
+static void name_index_update(name_index_t *idx, const name_table_t *t)
+{
+    if (!idx->dirty)
+        return;
+    name_index_free(idx);
+    idx->dirty = false;
+    if (!t->count)
+        return;
+
+    idx->names = calloc_or_fail(t->count, sizeof(char *), "name_index_update");
+    for (size_t i = 0; i < t->capacity; i++)
+        if (t->slots[i].name)
+            idx->names[idx->count++] = t->slots[i].name;
+    qsort(idx->names, idx->count, sizeof(char *), name_cmp);
+}
+
+/* Offer every indexed name starting with prefix, with lead prepended */
+static void name_index_complete(const name_index_t *idx,
+                                const char *lead,
+                                const char *prefix,
+                                line_completions_t *lc)
+{
+    size_t len = strlen(prefix);
+    size_t lo = 0, hi = idx->count;
+
+    /* Find first name not less than prefix */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->names[mid], prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (; lo < idx->count && !strncmp(idx->names[lo], prefix, len); lo++) {
+        char str[128];
+        /* if completion is too long, now we just ignore it */
+        if (snprintf(str, sizeof(str), "%s%s", lead, idx->names[lo]) >=
+            (int) sizeof(str))
+            continue;
+        line_add_completion(lc, str);
+    }
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -89,6 +264,9 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->param = param;
     cmd->next = next_cmd;
     *last_loc = cmd;
+
+    name_table_insert(&cmd_table, name, cmd);
+    cmd_index.dirty = true;
 }
 
 /* Add a new parameter */
@@ -109,53 +287,45 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+
+    name_table_insert(&param_table, name, param);
+    param_index.dirty = true;
 }
 
-/* Parse a string into a command line */
+/* Split a command line into arguments in place.
+ * White space is replaced with null characters and the returned vector
+ * points into line.  The vector is reused by the next call.
+ */
 static char **parse_args(char *line, int *argcp)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
-
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
-    char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
     int argc = 0;
-    while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
+    char *src = line;
+    while (true) {
+        while (isspace((unsigned char) *src))
+            src++;
+        if (*src == '\0')
+            break;
+
+        if (argc == argv_cap) {
+            int cap = argv_cap ? 2 * argv_cap : 16;
+            char **vec = malloc_or_fail(cap * sizeof(char *), "parse_args");
+            if (argv_vec) {
+                memcpy(vec, argv_vec, argc * sizeof(char *));
+                free_array(argv_vec, argv_cap, sizeof(char *));
             }
-            *dst++ = c;
+            argv_vec = vec;
+            argv_cap = cap;
         }
-    }
+        argv_vec[argc++] = src;
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+        while (*src != '\0' && !isspace((unsigned char) *src))
+            src++;
+        if (*src != '\0')
+            *src++ = '\0';
     }
 
-    free_block(buf, len + 1);
     *argcp = argc;
-    return argv;
+    return argv_vec;
 }
 
 static void record_error()
@@ -173,12 +343,21 @@ static bool interpret_cmda(int argc, char *argv[])
     if (argc == 0)
         return true;
     /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
+    cmd_element_t *next_cmd = name_table_find(&cmd_table, argv[0]);
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
-        ok = next_cmd->operation(argc, argv);
+        if (binlog_active()) {
+            /* quit frees the command list, though not the names in it, and
+             * closes the log, so that nothing else is recorded for it
+             */
+            const char *name = next_cmd->name;
+            binlog_mark_t mark;
+            binlog_begin(&mark);
+            ok = next_cmd->operation(argc, argv);
+            binlog_end(&mark, name, argc, argv, ok);
+        } else {
+            ok = next_cmd->operation(argc, argv);
+        }
         if (!ok)
             record_error();
     } else {
@@ -190,7 +369,178 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
-/* Execute a command from a command line */
+static bool is_block_start(int argc, char *argv[])
+{
+    return argc == 2 && strcmp(argv[0], "repeat") == 0;
+}
+
+static bool is_block_end(int argc, char *argv[])
+{
+    return argc >= 1 && strcmp(argv[0], "end") == 0;
+}
+
+static double now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static bool run_repeat(int reps, saved_cmd_t *cmds, int begin, int end);
+
+/* Execute saved commands [begin, end) once, descending into nested blocks */
+static bool run_cmds(saved_cmd_t *cmds, int begin, int end)
+{
+    for (int i = begin; i < end; i++) {
+        bool ok;
+        if (is_block_start(cmds[i].argc, cmds[i].argv)) {
+            int depth = 1, j = i;
+            while (depth > 0 && ++j < end) {
+                if (is_block_start(cmds[j].argc, cmds[j].argv))
+                    depth++;
+                else if (is_block_end(cmds[j].argc, cmds[j].argv))
+                    depth--;
+            }
+            /* The count was checked when the block was recorded */
+            int reps = 0;
+            get_int(cmds[i].argv[1], &reps);
+            ok = run_repeat(reps, cmds, i + 1, j);
+            i = j;
+        } else {
+            ok = interpret_cmda(cmds[i].argc, cmds[i].argv);
+        }
+        if (!ok || quit_flag)
+            return false;
+    }
+    return true;
+}
+
+/* Execute saved commands [begin, end) reps times.  The outermost repeat
+ * times every iteration and reports the distribution at the end.
+ */
+static bool run_repeat(int reps, saved_cmd_t *cmds, int begin, int end)
+{
+    bool timed = repeat_level++ == 0 && reps > 0;
+    double *lat =
+        timed ? malloc_or_fail(reps * sizeof(double), "run_repeat") : NULL;
+    double start = now_usec();
+    bool ok = true;
+    int done = 0;
+    while (ok && done < reps) {
+        double t = timed ? now_usec() : 0;
+        ok = run_cmds(cmds, begin, end);
+        if (timed)
+            lat[done] = now_usec() - t;
+        done++;
+    }
+    repeat_level--;
+
+    if (timed) {
+        double total = now_usec() - start, sum = 0;
+        qsort(lat, done, sizeof(double), cmp_double);
+        for (int i = 0; i < done; i++)
+            sum += lat[i];
+        int p99 = (int) (((long) done * 99 + 99) / 100) - 1;
+        report(1,
+               "Repeated %d/%d times in %.3f sec: min %.3f, mean %.3f, "
+               "p99 %.3f, max %.3f usec",
+               done, reps, total * 1e-6, lat[0], sum / done, lat[p99],
+               lat[done - 1]);
+        free_array(lat, reps, sizeof(double));
+    }
+    return ok;
+}
+
+static void free_block_cmds()
+{
+    for (int i = 0; i < block_len; i++) {
+        for (int j = 0; j < block_cmds[i].argc; j++)
+            free_string(block_cmds[i].argv[j]);
+        free_array(block_cmds[i].argv, block_cmds[i].argc, sizeof(char *));
+    }
+    if (block_cmds)
+        free_array(block_cmds, block_cap, sizeof(saved_cmd_t));
+    block_cmds = NULL;
+    block_len = block_cap = 0;
+    block_depth = block_reps = 0;
+    block_failed = false;
+    block_rio = NULL;
+    block_client = 0;
+}
+
+/* Parse the count of a repeat command, as do_repeat and blocks take it */
+static bool get_repeat_count(char *arg, int *reps)
+{
+    if (!get_int(arg, reps) || *reps < 0) {
+        report(1, "Invalid repeat count '%s'", arg);
+        return false;
+    }
+    return true;
+}
+
+/* Save a command line of the block being recorded.  Run the block once its
+ * closing 'end' is seen, unless a nested repeat in it had an invalid count.
+ */
+static bool record_block_cmd(int argc, char *argv[])
+{
+    if (argc == 0 || argv[0][0] == '#')
+        return true;
+
+    if (is_block_start(argc, argv)) {
+        int reps;
+        block_depth++;
+        if (!get_repeat_count(argv[1], &reps)) {
+            record_error();
+            block_failed = true;
+        }
+    } else if (is_block_end(argc, argv) && --block_depth == 0) {
+        if (block_failed) {
+            report(1, "Repeat block not run");
+            free_block_cmds();
+            return false;
+        }
+        /* Detach the block so that commands in it may start new ones */
+        saved_cmd_t *cmds = block_cmds;
+        int len = block_len, cap = block_cap;
+        block_cmds = NULL;
+        block_len = block_cap = 0;
+
+        bool ok = run_repeat(block_reps, cmds, 0, len);
+
+        block_cmds = cmds;
+        block_len = len;
+        block_cap = cap;
+        free_block_cmds();
+        return ok;
+    }
+
+    if (block_len == block_cap) {
+        int cap = block_cap ? 2 * block_cap : 16;
+        saved_cmd_t *cmds =
+            malloc_or_fail(cap * sizeof(saved_cmd_t), "record_block_cmd");
+        if (block_cmds) {
+            memcpy(cmds, block_cmds, block_len * sizeof(saved_cmd_t));
+            free_array(block_cmds, block_cap, sizeof(saved_cmd_t));
+        }
+        block_cmds = cmds;
+        block_cap = cap;
+    }
+
+    saved_cmd_t *cmd = &block_cmds[block_len++];
+    cmd->argc = argc;
+    cmd->argv = calloc_or_fail(argc, sizeof(char *), "record_block_cmd");
+    for (int i = 0; i < argc; i++)
+        cmd->argv[i] = strsave_or_fail(argv[i], "record_block_cmd");
+    return true;
+}
+
+/* Execute a command from a command line.  The line is modified in place */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
@@ -198,12 +548,11 @@ static bool interpret_cmd(char *cmdline)
 
     int argc;
     char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    /* Other inputs go on running their commands meanwhile */
+    if (block_depth > 0 && block_rio == buf_stack &&
+        block_client == web_client())
+        return record_block_cmd(argc, argv);
+    return interpret_cmda(argc, argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -239,9 +588,25 @@ static bool do_quit(int argc, char *argv[])
         free_block(ele, sizeof(param_element_t));
     }
 
+    cmd_list = NULL;
+    param_list = NULL;
+    name_table_free(&cmd_table);
+    name_table_free(&param_table);
+    name_index_free(&cmd_index);
+    name_index_free(&param_index);
+
+    if (argv_vec)
+        free_array(argv_vec, argv_cap, sizeof(char *));
+    argv_vec = NULL;
+    argv_cap = 0;
+
+    free_block_cmds();
     while (buf_stack)
         pop_file();
 
+    binlog_close();
+    web_pool_stop();
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
@@ -320,17 +685,14 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        /* Find parameter by name */
+        param_element_t *plist = name_table_find(&param_table, name);
+        if (plist) {
+            int oldval = *plist->valp;
+            *plist->valp = value;
+            if (plist->setter)
+                plist->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -342,8 +704,24 @@ static bool do_option(int argc, char *argv[])
     return true;
 }
 
+/* Set in web worker processes, which serve one connection each */
+static bool in_worker = false;
+
+/* Refuse a command that only the console process can carry out, e.g.
+ * because it reads from the terminal or opens files for the whole session
+ */
+bool console_only(char *name)
+{
+    if (!in_worker)
+        return true;
+    report(1, "%s is not available to web clients served by workers", name);
+    return false;
+}
+
 static bool do_source(int argc, char *argv[])
 {
+    if (!console_only(argv[0]))
+        return false;
     if (argc < 2) {
         report(1, "No source file given");
         return false;
@@ -359,6 +737,8 @@ static bool do_source(int argc, char *argv[])
 
 static bool do_log(int argc, char *argv[])
 {
+    if (!console_only(argv[0]))
+        return false;
     if (argc < 2) {
         report(1, "No log file given");
         return false;
@@ -371,6 +751,73 @@ static bool do_log(int argc, char *argv[])
     return result;
 }
 
+static bool do_repeat(int argc, char *argv[])
+{
+    int reps = 0;
+    if (argc < 2) {
+        report(1, "No repeat count given");
+        return false;
+    } else if (!get_repeat_count(argv[1], &reps)) {
+        return false;
+    }
+
+    if (argc == 2) {
+        /* Following lines up to the matching 'end' form the block */
+        if (repeat_level > 0) {
+            report(1, "A repeat block must start on a line of its own");
+            return false;
+        }
+        if (block_depth > 0) {
+            report(1, "Discarding the repeat block left open by another input");
+            free_block_cmds();
+        }
+        block_depth = 1;
+        block_reps = reps;
+        block_rio = buf_stack;
+        block_client = web_client();
+        return true;
+    }
+
+    saved_cmd_t cmd = {.argc = argc - 2, .argv = argv + 2};
+    return run_repeat(reps, &cmd, 0, 1);
+}
+
+static bool do_end(int argc, char *argv[])
+{
+    report(1, "'end' without matching 'repeat'");
+    return false;
+}
+
+static bool do_binlog(int argc, char *argv[])
+{
+    if (!console_only(argv[0]))
+        return false;
+    if (argc < 2) {
+        binlog_close();
+        return true;
+    }
+
+    bool result = binlog_open(argv[1]);
+    if (!result)
+        report(1, "Couldn't open binary log file '%s'", argv[1]);
+
+    return result;
+}
+
+static bool do_binstat(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "No binary log file given");
+        return false;
+    }
+
+    bool result = binlog_analyze(argv[1]);
+    if (!result)
+        report(1, "Couldn't analyze binary log file '%s'", argv[1]);
+
+    return result;
+}
+
 static bool do_time(int argc, char *argv[])
 {
     double delta = delta_time(&last_time);
@@ -394,17 +841,86 @@ static bool do_time(int argc, char *argv[])
 static bool use_linenoise = true;
 static int web_fd;
 
+/* Serve web clients through io_uring, where the kernel supports it */
+static int use_uring = 0;
+
+/* Worker side of the web server pool.  Option values are restored after
+ * every session, so that one client's settings do not leak into the next.
+ */
+static int *worker_params = NULL;
+
+static void web_worker_init(void)
+{
+    in_worker = true;
+    /* One writer per log file */
+    binlog_close();
+
+    int n = 0;
+    for (param_element_t *p = param_list; p; p = p->next)
+        n++;
+    worker_params = calloc_or_fail(n, sizeof(int), "web_worker_init");
+    n = 0;
+    for (param_element_t *p = param_list; p; p = p->next)
+        worker_params[n++] = *p->valp;
+}
+
+static bool web_worker_run(char *cmdline)
+{
+    interpret_cmd(cmdline);
+    report_flush();
+    return !quit_flag;
+}
+
+static void web_worker_reset(void)
+{
+    /* Quit helpers release whatever the session built up, e.g. its queues */
+    for (int i = 0; i < quit_helper_cnt; i++)
+        quit_helpers[i](0, NULL);
+
+    /* A repeat block left open or errors made are the session's own too */
+    free_block_cmds();
+    err_cnt = 0;
+    quit_flag = false;
+
+    int n = 0;
+    for (param_element_t *p = param_list; p; p = p->next, n++) {
+        int oldval = *p->valp;
+        *p->valp = worker_params[n];
+        if (p->setter && oldval != *p->valp)
+            p->setter(oldval);
+    }
+    report_flush();
+}
+
+static const web_worker_ops_t web_worker_ops = {
+    .init = web_worker_init,
+    .run = web_worker_run,
+    .reset = web_worker_reset,
+};
+
 static bool do_web(int argc, char *argv[])
 {
-    int port = 9999;
-    if (argc == 2) {
+    if (!console_only(argv[0]))
+        return false;
+    int port = 9999, nworkers = 0;
+    if (argc >= 2) {
         if (argv[1][0] >= '0' && argv[1][0] <= '9')
             port = atoi(argv[1]);
     }
+    if (argc >= 3 && (!get_int(argv[2], &nworkers) || nworkers < 0)) {
+        report(1, "Invalid number of workers '%s'", argv[2]);
+        return false;
+    }
 
-    web_fd = web_open(port);
-    if (web_fd > 0) {
-        printf("listen on port %d, fd is %d\n", port, web_fd);
+    /* Workers serve one connection at a time and have no need for it */
+    web_fd = web_open(port, use_uring && !nworkers);
+    if (web_fd > 0 && nworkers > 0) {
+        nworkers = web_pool_start(nworkers, &web_worker_ops);
+        printf("listen on port %d, served by %d worker processes\n", port,
+               nworkers);
+    } else if (web_fd > 0) {
+        printf("listen on port %d, fd is %d%s\n", port, web_fd,
+               web_uring() ? ", using io_uring" : "");
         line_set_eventmux_callback(web_eventmux);
         use_linenoise = false;
     } else {
@@ -419,6 +935,7 @@ void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    cmd_index.dirty = param_index.dirty = true;
     err_cnt = 0;
     quit_flag = false;
 
@@ -429,10 +946,25 @@ void init_cmd()
     ADD_COMMAND(quit, "Exit program", "");
     ADD_COMMAND(source, "Read commands from source file", "");
     ADD_COMMAND(log, "Copy output to file", "file");
+    ADD_COMMAND(binlog,
+                "Record commands to binary event log (stop if no file given)",
+                "[file]");
+    ADD_COMMAND(binstat, "Show per-command timing histograms of binary log",
+                "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
-    ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(repeat,
+                "Run cmd n times, or the lines up to 'end' when no cmd is "
+                "given, and report min/mean/p99 timing",
+                "n [cmd arg ...]");
+    ADD_COMMAND(end, "End block of commands started by repeat", "");
+    ADD_COMMAND(web,
+                "Read commands from builtin web server, optionally run by "
+                "worker processes with a queue context per connection",
+                "[port] [workers]");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
+    add_param("uring", &use_uring,
+              "Serve web clients through io_uring where supported", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
@@ -485,59 +1017,69 @@ static void init_in()
 }
 
 /* Read command from input file.
+ * Return pointer to the line inside the input buffer, without its newline.
  * When hit EOF, close that file and return NULL
  */
 static char *readline()
 {
-    char c;
-    char *lptr = linebuf;
-
     if (!buf_stack)
         return NULL;
 
-    for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
-        if (buf_stack->count <= 0) {
-            /* Need to read from input file */
-            buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
-            buf_stack->bufptr = buf_stack->buf;
-            if (buf_stack->count <= 0) {
-                /* Encountered EOF */
-                pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
-                return NULL;
-            }
+    rio_t *rio = buf_stack;
+    char *line = NULL;
+    while (!line) {
+        char *eol = rio->count > 0 ? memchr(rio->bufptr, '\n', rio->count)
+                                   : NULL;
+        if (eol) {
+            *eol = '\0';
+            line = rio->bufptr;
+            rio->count -= eol + 1 - rio->bufptr;
+            rio->bufptr = eol + 1;
+            break;
         }
 
-        /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->count--;
-        if (c == '\n')
+        if (rio->count == RIO_BUFSIZE) {
+            /* Hit buffer limit.  Artificially terminate line */
+            rio->buf[RIO_BUFSIZE] = '\0';
+            line = rio->buf;
+            rio->count = 0;
             break;
-    }
+        }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
-        *lptr++ = '\n';
+        /* Keep the partial line and read another block behind it */
+        if (rio->bufptr != rio->buf) {
+            memmove(rio->buf, rio->bufptr, rio->count);
+            rio->bufptr = rio->buf;
+        }
+        int n = read(rio->fd, rio->buf + rio->count, RIO_BUFSIZE - rio->count);
+        if (n <= 0) {
+            /* Encountered EOF */
+            if (rio->count == 0) {
+                if (block_depth > 0 && block_rio == rio) {
+                    report(1, "Repeat block not closed by the end of input");
+                    record_error();
+                    free_block_cmds();
+                }
+                pop_file();
+                return NULL;
+            }
+            /* Last line of file did not terminate with newline.
+             * Return it now; EOF is seen again on the next call.
+             */
+            rio->buf[rio->count] = '\0';
+            line = rio->buf;
+            rio->count = 0;
+            break;
+        }
+        rio->count += n;
     }
-    *lptr++ = '\0';
 
     if (echo) {
         report_noreturn(1, prompt);
-        report_noreturn(1, linebuf);
+        report(1, "%s", line);
     }
 
-    return linebuf;
+    return line;
 }
 
 static bool cmd_done()
@@ -554,7 +1096,6 @@ static bool cmd_done()
  * nfds should be set to the maximum file descriptor for network sockets.
  * If nfds == 0, this indicates that there is no pending network activity
  */
-int web_connfd;
 static int cmd_select(int nfds,
                       fd_set *readfds,
                       fd_set *writefds,
@@ -582,10 +1123,15 @@ static int cmd_select(int nfds,
             FD_SET(web_fd, readfds);
 
         if (infd == STDIN_FILENO && prompt_flag) {
+            report_flush();
             char *cmdline = linenoise(prompt);
-            if (cmdline)
+            if (cmdline) {
                 interpret_cmd(cmdline);
-            fflush(stdout);
+                line_free(cmdline);
+            }
+            report_flush();
+            /* Command came from the web: complete the response */
+            web_done();
             prompt_flag = true;
         } else if (infd != STDIN_FILENO) {
             char *cmdline = readline();
@@ -605,45 +1151,16 @@ bool finish_cmd()
     return ok && err_cnt == 0;
 }
 
-static bool cmd_maybe(const char *target, const char *src)
-{
-    for (int i = 0; i < strlen(src); i++) {
-        if (target[i] == '\0')
-            return false;
-        if (src[i] != target[i])
-            return false;
-    }
-    return true;
-}
-
 void completion(const char *buf, line_completions_t *lc)
 {
     if (strncmp("option ", buf, 7) == 0) {
-        param_element_t *plist = param_list;
-
-        while (plist) {
-            char str[128] = "";
-            /* if parameter is too long, now we just ignore it */
-            if (strlen(plist->name) > 120)
-                continue;
-
-            strcat(str, "option ");
-            strcat(str, plist->name);
-            if (cmd_maybe(str, buf))
-                line_add_completion(lc, str);
-
-            plist = plist->next;
-        }
+        name_index_update(&param_index, &param_table);
+        name_index_complete(&param_index, "option ", buf + 7, lc);
         return;
     }
 
-    cmd_element_t *clist = cmd_list;
-    while (clist) {
-        if (cmd_maybe(clist->name, buf))
-            line_add_completion(lc, clist->name);
-
-        clist = clist->next;
-    }
+    name_index_update(&cmd_index, &cmd_table);
+    name_index_complete(&cmd_index, "", buf, lc);
 }
 
 bool run_console(char *infile_name)
@@ -655,14 +1172,16 @@ bool run_console(char *infile_name)
 
     if (!has_infile) {
         char *cmdline;
+        report_flush();
         while (use_linenoise && (cmdline = linenoise(prompt))) {
-            interpret_cmd(cmdline);
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
+            interpret_cmd(cmdline);
             line_free(cmdline);
             while (buf_stack && buf_stack->fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
             has_infile = false;
+            report_flush();
         }
         if (!use_linenoise) {
             while (!cmd_done())
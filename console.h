@@ -56,6 +56,11 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Return true if the console itself runs command name.  Otherwise report
+ * that a web worker cannot run it and return false.
+ */
+bool console_only(char *name);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -13,6 +13,7 @@
 
 #include "agents/mcts.h"
 #include "agents/negamax.h"
+#include "agents/util.h"
 #include "game.h"
 
 #if defined(__APPLE__)
@@ -21,8 +22,10 @@
 #include <time.h>
 #endif
 
-static int move_record[N_GRIDS];
+static int move_record[MAX_GRIDS];
 static int move_count = 0;
+static move_stats_t mcts_stats = {.name = "MCTS"};
+static move_stats_t negamax_stats = {.name = "negamax"};
 
 struct task {
     jmp_buf env;
@@ -42,13 +45,15 @@ static jmp_buf sched;
 static struct task *cur_task;
 static bool roundend = false;
 static int rounds;
-static char table[N_GRIDS];
+static char table[MAX_GRIDS];
 static int i;
 static bool stop = false;
 
+/* Note a move played, by either side; MCTS carries its tree over to it */
 static void record_move(int move)
 {
     move_record[move_count++] = move;
+    mcts_play(move);
 }
 
 static void print_moves()
@@ -115,7 +120,9 @@ void task_ai1(void *arg)
     }
 
     char ai = 'X';
-    int move = mcts(table, ai);
+    uint64_t start = now_usec();
+    int move = mcts(table, ai, move_budget);
+    move_stats_add(&mcts_stats, now_usec() - start);
     if (move != -1) {
         table[move] = ai;
         record_move(move);
@@ -145,7 +152,9 @@ void task_ai2(void *arg)
         longjmp(sched, 1);
     }
     char ai = 'O';
-    int move = negamax_predict(table, ai).move;
+    uint64_t start = now_usec();
+    int move = negamax_predict(table, ai, move_budget).move;
+    move_stats_add(&negamax_stats, now_usec() - start);
     if (move != -1) {
         table[move] = ai;
         record_move(move);
@@ -193,6 +202,8 @@ void task_drawboard_checkwin(void *arg)
     }
     if (roundend) {  // current games is end,reset the game
         print_moves();
+        move_stats_report(&mcts_stats);
+        move_stats_report(&negamax_stats);
         move_count = 0;
         memset(table, ' ', N_GRIDS);
         roundend = false;
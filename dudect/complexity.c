@@ -0,0 +1,177 @@
+/* Is my code in the complexity class I think it is?
+ *
+ * Unlike the constant time tests, which tell two classes of inputs apart,
+ * this measures an operation on queues of sizes growing from MIN_SIZE by
+ * powers of two and takes the slope of the log of the median times against
+ * the log of the sizes: about 0 for O(1), 1 for O(n), 1 + 1 / ln n for
+ * O(n log n) and 2 for O(n^2).  The class named is the one the slope is
+ * closest to, over the median of N_TRIES tries.
+ *
+ * O(n) and O(n log n) are only a fifth apart in slope, and both the fixed
+ * cost of a call on small queues and cache misses on large ones bend the
+ * times by as much, so the check does not tell them apart: an operation
+ * fails only once its slope is past what either allows by a wide margin.
+ * Linear and linearithmic operations come out below 1.3 and quadratic ones
+ * above 1.8, against a limit of 1.6.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
+#include "complexity.h"
+#include "cpucycles.h"
+#include "fixture.h"
+#include "queue.h"
+#include "random.h"
+
+#define MIN_SIZE 4
+#define N_SIZES 9
+#define N_REPEATS 15
+#define N_TRIES 5
+
+#define N_CLASSES (COMPLEXITY_N2 + 1)
+
+/* Slopes past which each class no longer fits, halfway to the next */
+static const double thresholds[N_CLASSES - 1] = {0.5, 1.1, 1.6};
+
+/* Slopes past which an operation fails to be in each class */
+static const double limits[N_CLASSES] = {
+    [COMPLEXITY_1] = 0.5,
+    [COMPLEXITY_N] = 1.6,
+    [COMPLEXITY_N_LOG_N] = 1.6,
+    [COMPLEXITY_N2] = HUGE_VAL,
+};
+
+static const char *names[N_CLASSES] = {
+    [COMPLEXITY_1] = "O(1)",
+    [COMPLEXITY_N] = "O(n)",
+    [COMPLEXITY_N_LOG_N] = "O(n log n)",
+    [COMPLEXITY_N2] = "O(n^2)",
+};
+
+const char *complexity_name(complexity_t c)
+{
+    return names[c];
+}
+
+static void random_string(char *s, size_t len)
+{
+    randombytes((uint8_t *) s, len);
+    for (size_t i = 0; i < len; i++)
+        s[i] = 'a' + (uint8_t) s[i] % 26;
+    s[len] = '\0';
+}
+
+static void walk(const struct list_head *head)
+{
+    for (const struct list_head *li = head->next; li != head; li = li->next)
+        __asm__ volatile("" : : "r"(li));
+}
+
+/* Cycles op takes on a queue of n random strings, -1 if disturbed */
+static int64_t run_once(int op, int n)
+{
+    struct list_head *l = q_new();
+    char s[8];
+
+    for (int i = 0; i < n; i++) {
+        random_string(s, sizeof(s) - 1);
+        q_insert_head(l, s);
+    }
+
+    /* Bring the queue into cache */
+    walk(l);
+
+    cpucycles_mark_t mark;
+    int64_t before = cpucycles_begin(&mark);
+    switch (op) {
+    case SCALE(size):
+        q_size(l);
+        break;
+    case SCALE(reverse):
+        q_reverse(l);
+        break;
+    case SCALE(sort):
+        q_sort(l, false);
+        break;
+    case SCALE(delete_mid):
+        q_delete_mid(l);
+        break;
+    default:
+        assert(0);
+    }
+    int64_t after = cpucycles_end(&mark, before);
+
+    q_free(l);
+    return after != before ? after - before : -1;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Median of N_REPEATS undisturbed runs on queues of n elements */
+static double measure_size(int op, int n)
+{
+    int64_t samples[N_REPEATS];
+
+    for (int i = 0; i < N_REPEATS;) {
+        int64_t cycles = run_once(op, n);
+        if (cycles > 0)
+            samples[i++] = cycles;
+    }
+    qsort(samples, N_REPEATS, sizeof(int64_t), cmp);
+    return samples[N_REPEATS / 2];
+}
+
+/* Least squares slope of log(time) against log(n) */
+static double slope_of(int op)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+    for (int i = 0; i < N_SIZES; i++) {
+        double x = log2(MIN_SIZE << i);
+        double y = log2(measure_size(op, MIN_SIZE << i));
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    return (N_SIZES * sxy - sx * sy) / (N_SIZES * sxx - sx * sx);
+}
+
+bool complexity_check(int op, complexity_t expected, complexity_t *found)
+{
+    double slopes[N_TRIES];
+
+    cpucycles_open(dudect_counter);
+    /* Freeing must not scan every block allocated */
+    set_cautious_mode(false);
+    for (int i = 0; i < N_TRIES; i++)
+        slopes[i] = slope_of(op);
+    set_cautious_mode(true);
+    cpucycles_close();
+
+    qsort(slopes, N_TRIES, sizeof(double), cmp_double);
+    double slope = slopes[N_TRIES / 2];
+
+    complexity_t c = 0;
+    while (c < COMPLEXITY_N2 && slope > thresholds[c])
+        c++;
+    *found = c;
+    return slope <= limits[expected];
+}
@@ -0,0 +1,38 @@
+#ifndef DUDECT_COMPLEXITY_H
+#define DUDECT_COMPLEXITY_H
+
+#include <stdbool.h>
+
+/* Complexity classes, from the slowest growing */
+typedef enum {
+    COMPLEXITY_1,
+    COMPLEXITY_N,
+    COMPLEXITY_N_LOG_N,
+    COMPLEXITY_N2,
+} complexity_t;
+
+/* Operations whose running time is checked against the size of the queue */
+#define SCALE_FUNCS \
+    _(size)         \
+    _(reverse)      \
+    _(sort)         \
+    _(delete_mid)
+
+#define SCALE(x) SCALE_##x
+
+enum {
+#define _(x) SCALE(x),
+    SCALE_FUNCS
+#undef _
+};
+
+/* Measure how the running time of operation op grows with the size of the
+ * queue and store the class it is closest to in found.  Return whether it
+ * grows no faster than expected allows, which does not tell O(n) and
+ * O(n log n) apart.
+ */
+bool complexity_check(int op, complexity_t expected, complexity_t *found);
+
+const char *complexity_name(complexity_t c);
+
+#endif
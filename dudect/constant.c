@@ -14,12 +14,6 @@ static struct list_head *l = NULL;
 
 #define dut_new() ((void) (l = q_new()))
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
-
 #define dut_insert_head(s, n)    \
     do {                         \
         int j = n;               \
@@ -84,9 +78,10 @@ bool measure(int64_t *before_ticks,
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            cpucycles_mark_t mark;
+            before_ticks[i] = cpucycles_begin(&mark);
             dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end(&mark, before_ticks[i]);
             int after_size = q_size(l);
             dut_free();
             if (before_size != after_size - 1)
@@ -101,9 +96,10 @@ bool measure(int64_t *before_ticks,
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            cpucycles_mark_t mark;
+            before_ticks[i] = cpucycles_begin(&mark);
             dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end(&mark, before_ticks[i]);
             int after_size = q_size(l);
             dut_free();
             if (before_size != after_size - 1)
@@ -117,9 +113,10 @@ bool measure(int64_t *before_ticks,
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            cpucycles_mark_t mark;
+            before_ticks[i] = cpucycles_begin(&mark);
             element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end(&mark, before_ticks[i]);
             int after_size = q_size(l);
             if (e)
                 q_release_element(e);
@@ -135,9 +132,10 @@ bool measure(int64_t *before_ticks,
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            cpucycles_mark_t mark;
+            before_ticks[i] = cpucycles_begin(&mark);
             element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end(&mark, before_ticks[i]);
             int after_size = q_size(l);
             if (e)
                 q_release_element(e);
@@ -146,17 +144,6 @@ bool measure(int64_t *before_ticks,
                 return false;
         }
         break;
-    default:
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
     }
     return true;
 }
@@ -0,0 +1,101 @@
+/* Counters for dudect measurements.
+ *
+ * The TSC counts wall-clock cycles, so whatever runs on the CPU in between,
+ * interrupt handlers included, adds to a measurement.  Hardware counters set
+ * up through perf events count the cycles or instructions of this process in
+ * user mode only, at the cost of a system call per reading.  Instruction
+ * counts hardly vary from one run to the next, which makes leaks stand out
+ * with fewer measurements.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cpucycles.h"
+
+/* Readings taken to calibrate the overhead of measuring */
+#define CALIBRATE_ROUNDS 1000
+
+int cpucycles_fd = -1;
+
+/* Process the perf event was opened by.  Counters are not shared with
+ * forked children, which need to open their own.
+ */
+static pid_t owner;
+
+static int perf_open(int counter)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counter == COUNTER_CYCLES ? PERF_COUNT_HW_CPU_CYCLES
+                                            : PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+int cpucycles_open(int counter)
+{
+    cpucycles_close();
+    if (counter == COUNTER_CYCLES || counter == COUNTER_INSTRUCTIONS) {
+        cpucycles_fd = perf_open(counter);
+        owner = getpid();
+    }
+    return cpucycles_fd >= 0 ? counter : COUNTER_TSC;
+}
+
+void cpucycles_close(void)
+{
+    /* Leave the event of the parent process alone */
+    if (cpucycles_fd >= 0 && owner == getpid())
+        close(cpucycles_fd);
+    cpucycles_fd = -1;
+}
+
+int64_t cpucycles_overhead(void)
+{
+    int64_t min = INT64_MAX;
+
+    for (int i = 0; i < CALIBRATE_ROUNDS; i++) {
+        cpucycles_mark_t mark;
+        int64_t begin = cpucycles_begin(&mark);
+        int64_t end = cpucycles_end(&mark, begin);
+        if (end != begin && end - begin < min)
+            min = end - begin;
+    }
+    return min == INT64_MAX ? 0 : min;
+}
+
+int64_t cpucycles_perf(void)
+{
+    uint64_t count;
+
+    if (read(cpucycles_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+long cpucycles_switches(void)
+{
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        return usage.ru_nivcsw;
+#endif
+    return 0;
+}
@@ -3,12 +3,49 @@
 
 #include <stdint.h>
 
+/* Counters measurements may be taken with */
+enum {
+    COUNTER_TSC,          /* Time stamp counter, always available */
+    COUNTER_CYCLES,       /* CPU cycles spent in user mode (perf events) */
+    COUNTER_INSTRUCTIONS, /* Instructions retired in user mode (perf events) */
+};
+
+/* File descriptor of the perf event in use, -1 when reading the TSC */
+extern int cpucycles_fd;
+
+/* Take the measurements of this process with the given counter, falling back
+ * to the TSC when it cannot be opened.  Return the counter actually used.
+ */
+int cpucycles_open(int counter);
+void cpucycles_close(void);
+
+/* Smallest count between cpucycles_begin() and cpucycles_end() with nothing
+ * in between, i.e. the cost of measuring itself
+ */
+int64_t cpucycles_overhead(void);
+
+int64_t cpucycles_perf(void);
+
+/* Times the thread was preempted so far */
+long cpucycles_switches(void);
+
+/* The counter is read where every earlier instruction has executed, and no
+ * later one starts before it is read.  cpu is set to the CPU the counter
+ * was read on, 0 if unknown.
+ */
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
-static inline int64_t cpucycles(void)
+static inline int64_t cpucycles(unsigned *cpu)
 {
+    if (cpucycles_fd >= 0) {
+        *cpu = 0;
+        return cpucycles_perf();
+    }
 #if defined(__i386__) || defined(__x86_64__)
     unsigned int hi, lo;
-    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+    __asm__ volatile("rdtscp\n\tlfence"
+                     : "=a"(lo), "=d"(hi), "=c"(*cpu)
+                     :
+                     : "memory");
     return ((int64_t) lo) | (((int64_t) hi) << 32);
 
 #elif defined(__aarch64__)
@@ -19,11 +56,40 @@ static inline int64_t cpucycles(void)
      * bits wide and it is attributed with the flag 'cap_user_time_short'
      * is true.
      */
-    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val) : : "memory");
+    *cpu = 0;
     return val;
 #else
 #error Unsupported Architecture
 #endif
 }
 
+/* State of a measurement in progress */
+typedef struct {
+    unsigned cpu;
+    long switches;
+} cpucycles_mark_t;
+
+/* Read the counter ahead of the code under measurement */
+static inline int64_t cpucycles_begin(cpucycles_mark_t *mark)
+{
+    mark->switches = cpucycles_switches();
+    return cpucycles(&mark->cpu);
+}
+
+/* Read the counter after the code under measurement.  When the thread moved
+ * to another CPU or was preempted in between, return begin instead, so that
+ * the measurement reads as dropped.
+ */
+static inline int64_t cpucycles_end(const cpucycles_mark_t *mark,
+                                    int64_t begin)
+{
+    unsigned cpu;
+    int64_t end = cpucycles(&cpu);
+
+    if (cpu != mark->cpu || cpucycles_switches() != mark->switches)
+        return begin;
+    return end;
+}
+
 #endif
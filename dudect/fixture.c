@@ -26,24 +26,73 @@
  *    variable time.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "../console.h"
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
 #include "fixture.h"
 #include "ttest.h"
 
+/* From report.h, whose report() clashes with the one here */
+extern void report_flush(void);
+
 #define ENOUGH_MEASURE 10000
 #define TEST_TRIES 10
+#define N_BATCHES (ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1)
+
+/* Measurements taken in a batch, the dropped ones aside */
+#define N_MEASURED (N_MEASURES - DROP_SIZE * 2)
+
+/* Cropping thresholds, and the tests run: one on the raw execution times,
+ * one per cropping threshold and a second-order one.
+ */
+#define N_PERCENTILES 100
+#define N_TESTS (N_PERCENTILES + 2)
+#define SECOND_ORDER_TEST (N_PERCENTILES + 1)
+
+/* Samples a test needs before its t value is taken into account */
+#define MIN_TEST_MEASURE (ENOUGH_MEASURE / 10)
+
+/* Upper bound on the processes measuring batches at the same time */
+#define MAX_WORKERS 8
+
+static t_context_t t[N_TESTS];
+static int64_t percentiles[N_PERCENTILES];
+
+int dudect_counter = COUNTER_TSC;
+
+/* Counter in use and the cost of a measurement in its units */
+static int counter;
+static int64_t overhead;
 
-static t_context_t *t;
+/* Measurements of one batch, as sent back by a worker */
+typedef struct {
+    int64_t exec_times[N_MEASURES];
+    uint8_t classes[N_MEASURES];
+    bool ok;
+} batch_result_t;
+
+/* Buffers of a batch, reused from one batch to the next */
+typedef struct {
+    int64_t before_ticks[N_MEASURES + 1];
+    int64_t after_ticks[N_MEASURES + 1];
+    uint8_t input_data[N_MEASURES * CHUNK_SIZE];
+    batch_result_t res;
+} batch_buf_t;
 
 /* threshold values for Welch's t-test */
 enum {
@@ -61,10 +110,33 @@ static void differentiate(int64_t *exec_times,
                           const int64_t *after_ticks)
 {
     for (size_t i = 0; i < N_MEASURES; i++)
-        exec_times[i] = after_ticks[i] - before_ticks[i];
+        exec_times[i] = after_ticks[i] - before_ticks[i] - overhead;
 }
 
-static void update_statistics(const int64_t *exec_times, uint8_t *classes)
+static int cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Set the cropping thresholds from the measurements of a first batch.  They
+ * grow towards the slowest of them: the first one keeps about 7% of the
+ * execution times, the last one all but the slowest 0.1%.
+ */
+static void prepare_percentiles(const int64_t *exec_times)
+{
+    int64_t sorted[N_MEASURED];
+
+    memcpy(sorted, exec_times + DROP_SIZE, sizeof(sorted));
+    qsort(sorted, N_MEASURED, sizeof(int64_t), cmp);
+    for (size_t i = 0; i < N_PERCENTILES; i++) {
+        double which = 1 - pow(0.5, 10 * (double) (i + 1) / N_PERCENTILES);
+        percentiles[i] = sorted[(size_t) (which * N_MEASURED)];
+    }
+}
+
+static void update_statistics(const int64_t *exec_times,
+                              const uint8_t *classes)
 {
     for (size_t i = 0; i < N_MEASURES; i++) {
         int64_t difference = exec_times[i];
@@ -73,24 +145,57 @@ static void update_statistics(const int64_t *exec_times, uint8_t *classes)
             continue;
 
         /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        t_push(&t[0], difference, classes[i]);
+
+        /* do a t-test on cropped execution times, for several thresholds */
+        for (size_t crop = 0; crop < N_PERCENTILES; crop++) {
+            if (difference < percentiles[crop])
+                t_push(&t[crop + 1], difference, classes[i]);
+        }
+
+        /* second-order test, once the means are settled */
+        if (t[0].n[0] + t[0].n[1] >= MIN_TEST_MEASURE) {
+            double centered = difference - t[0].mean[classes[i]];
+            t_push(&t[SECOND_ORDER_TEST], centered * centered, classes[i]);
+        }
     }
 }
 
+/* The test with the largest t value among those with enough samples */
+static t_context_t *max_test(void)
+{
+    t_context_t *ret = &t[0];
+    double max = 0;
+
+    for (size_t i = 0; i < N_TESTS; i++) {
+        if (t[i].n[0] + t[i].n[1] < MIN_TEST_MEASURE)
+            continue;
+        double x = fabs(t_compute(&t[i]));
+        if (x > max) {
+            max = x;
+            ret = &t[i];
+        }
+    }
+    return ret;
+}
+
 static bool report(void)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
-    double max_tau = max_t / sqrt(number_traces_max_t);
+    double number_traces = t[0].n[0] + t[0].n[1];
 
     printf("\033[A\033[2K");
-    printf("meas: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    printf("meas: %7.2lf M, ", (number_traces / 1e6));
+    if (number_traces < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - number_traces);
         return false;
     }
 
+    t_context_t *max = max_test();
+    double max_t = fabs(t_compute(max));
+    double number_traces_max_t = max->n[0] + max->n[1];
+    double max_tau = max_t / sqrt(number_traces_max_t);
+
     /* max_t: the t statistic value
      * max_tau: a t value normalized by sqrt(number of measurements).
      *          this way we can compare max_tau taken with different
@@ -116,57 +221,180 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+/* A leak this large shows long before there are enough measurements */
+static bool conclusive(void)
 {
-    int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *exec_times = calloc(N_MEASURES, sizeof(int64_t));
-    uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
-    uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
+    return t[0].n[0] + t[0].n[1] >= MIN_TEST_MEASURE &&
+           fabs(t_compute(max_test())) > t_threshold_bananas;
+}
 
-    if (!before_ticks || !after_ticks || !exec_times || !classes ||
-        !input_data) {
-        die();
+static void measure_batch(batch_buf_t *buf, int mode)
+{
+    batch_result_t *res = &buf->res;
+
+    prepare_inputs(buf->input_data, res->classes);
+    res->ok =
+        measure(buf->before_ticks, buf->after_ticks, buf->input_data, mode);
+    differentiate(res->exec_times, buf->before_ticks, buf->after_ticks);
+}
+
+static bool run_batches(batch_buf_t *buf, int mode)
+{
+    bool ok = true, result = false;
+
+    for (int i = 0; i < N_BATCHES; ++i) {
+        measure_batch(buf, mode);
+        ok &= buf->res.ok;
+        update_statistics(buf->res.exec_times, buf->res.classes);
+        result = report();
+        if (conclusive())
+            break;
     }
+    return ok && result;
+}
 
-    prepare_inputs(input_data, classes);
+/* CPUs this process may run on, at most MAX_WORKERS of them */
+static int allowed_cpus(int *cpus)
+{
+    cpu_set_t set;
+    int n = 0;
 
-    bool ret = measure(before_ticks, after_ticks, input_data, mode);
-    differentiate(exec_times, before_ticks, after_ticks);
-    update_statistics(exec_times, classes);
-    ret &= report();
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        return 1;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < MAX_WORKERS; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+            cpus[n++] = cpu;
+    }
+    return n > 0 ? n : 1;
+}
 
-    free(before_ticks);
-    free(after_ticks);
-    free(exec_times);
-    free(classes);
-    free(input_data);
+static void pin(int cpu)
+{
+    cpu_set_t set;
 
-    return ret;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static bool read_result(int fd, batch_result_t *res)
+{
+    size_t off = 0;
+
+    while (off < sizeof(*res)) {
+        ssize_t n = read(fd, (char *) res + off, sizeof(*res) - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        off += n;
+    }
+    return true;
 }
 
-static void init_once(void)
+/* Measure the batches of a try in nworkers processes, each pinned to a CPU
+ * of its own.  The queue under test allocates through the harness, which is
+ * not thread-safe, so workers are forked rather than spawned as threads.
+ * The measurements of every batch come back here to be added to the tests
+ * as they arrive; a conclusive result stops the workers early.
+ */
+static bool run_workers(batch_buf_t *buf,
+                        int mode,
+                        const int *cpus,
+                        int nworkers)
+{
+    pid_t pids[MAX_WORKERS];
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return run_batches(buf, mode);
+
+    /* Workers must not inherit output still pending, to write it again */
+    fflush(NULL);
+    report_flush();
+    int started = 0;
+    for (; started < nworkers; started++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            break;
+        if (pid == 0) {
+            close(fds[0]);
+            pin(cpus[started]);
+            /* Counts in the same units as the parent, or not at all */
+            if (cpucycles_open(counter) != counter)
+                _exit(1);
+            for (int i = started; i < N_BATCHES; i += nworkers) {
+                measure_batch(buf, mode);
+                /* Results fit in PIPE_BUF, hence are written atomically */
+                if (write(fds[1], &buf->res, sizeof(buf->res)) !=
+                    sizeof(buf->res))
+                    break;
+            }
+            _exit(0);
+        }
+        pids[started] = pid;
+    }
+    close(fds[1]);
+
+    bool ok = started == nworkers, result = false;
+    batch_result_t res;
+    int done = 0;
+    while (ok && read_result(fds[0], &res)) {
+        ok &= res.ok;
+        update_statistics(res.exec_times, res.classes);
+        result = report();
+        if (++done == N_BATCHES || conclusive())
+            break;
+    }
+    close(fds[0]);
+
+    for (int i = 0; i < started; i++) {
+        kill(pids[i], SIGKILL);
+        while (waitpid(pids[i], NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+    return ok && result && done == N_BATCHES;
+}
+
+/* Start a try afresh, with cropping thresholds from a batch of its own */
+static void init_once(batch_buf_t *buf, int mode)
 {
     init_dut();
-    t_init(t);
+    for (size_t i = 0; i < N_TESTS; i++)
+        t_init(&t[i]);
+    measure_batch(buf, mode);
+    prepare_percentiles(buf->res.exec_times);
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_context_t));
+    int cpus[MAX_WORKERS];
+    int nworkers = allowed_cpus(cpus);
+    batch_buf_t *buf = calloc(1, sizeof(batch_buf_t));
+
+    if (!buf)
+        die();
+
+    counter = cpucycles_open(dudect_counter);
+    if (counter != dudect_counter)
+        printf("Counter %d is not available, using the TSC\n",
+               dudect_counter);
+    overhead = cpucycles_overhead();
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
-        init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
-            result = doit(mode);
+        init_once(buf, mode);
+        if (nworkers > 1)
+            result = run_workers(buf, mode, cpus, nworkers);
+        else
+            result = run_batches(buf, mode);
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
-    free(t);
+    cpucycles_close();
+    free(buf);
     return result;
 }
 
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include "constant.h"
 
+/* Counter to measure with, one of COUNTER_* in cpucycles.h */
+extern int dudect_counter;
+
 /* Interface to test if function is constant */
 #define _(x) bool is_##x##_const(void);
 DUT_FUNCS
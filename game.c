@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <ctype.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,60 +8,23 @@
 
 #include "game.h"
 
-#define LOOKUP(table, i, j, else_value)                         \
-    ((i) < 0 || (j) < 0 || (i) > BOARD_SIZE || (j) > BOARD_SIZE \
-         ? (else_value)                                         \
-         : (table)[GET_INDEX(i, j)])
-
-_Static_assert(BOARD_SIZE <= 26, "Board size must not be greater than 26");
-_Static_assert(BOARD_SIZE > 0, "Board size must be greater than 0");
-_Static_assert(GOAL <= BOARD_SIZE, "Goal must not be greater than board size");
-_Static_assert(GOAL > 0, "Goal must be greater than 0");
 _Static_assert(ALLOW_EXCEED == 0 || ALLOW_EXCEED == 1,
                "ALLOW_EXCEED must be a boolean that is 0 or 1");
 
-const line_t lines[4] = {
-    {1, 0, 0, 0, BOARD_SIZE - GOAL + 1, BOARD_SIZE},             // ROW
-    {0, 1, 0, 0, BOARD_SIZE, BOARD_SIZE - GOAL + 1},             // COL
-    {1, 1, 0, 0, BOARD_SIZE - GOAL + 1, BOARD_SIZE - GOAL + 1},  // PRIMARY
-    {1, -1, 0, GOAL - 1, BOARD_SIZE - GOAL + 1, BOARD_SIZE},     // SECONDARY
-};
-
-static char check_line_segment_win(const char *t, int i, int j, line_t line)
+void board_from_table(board_t *b, const char *t)
 {
-    char last = t[GET_INDEX(i, j)];
-    if (last == ' ')
-        return ' ';
-    for (int k = 1; k < GOAL; k++) {
-        if (last != t[GET_INDEX(i + k * line.i_shift, j + k * line.j_shift)]) {
-            return ' ';
-        }
+    b->mask[0] = b->mask[1] = 0;
+    for (int i = 0; i < N_GRIDS; i++) {
+        if (t[i] != ' ')
+            board_play(b, i, t[i]);
     }
-#if !ALLOW_EXCEED
-    if (last == LOOKUP(t, i - line.i_shift, j - line.j_shift, ' ') ||
-        last ==
-            LOOKUP(t, i + GOAL * line.i_shift, j + GOAL * line.j_shift, ' '))
-        return ' ';
-#endif
-    return last;
 }
 
 char check_win(char *t)
 {
-    for (int i_line = 0; i_line < 4; ++i_line) {
-        line_t line = lines[i_line];
-        for (int i = line.i_lower_bound; i < line.i_upper_bound; ++i) {
-            for (int j = line.j_lower_bound; j < line.j_upper_bound; ++j) {
-                char win = check_line_segment_win(t, i, j, line);
-                if (win != ' ')
-                    return win;
-            }
-        }
-    }
-    for (int i = 0; i < N_GRIDS; i++)
-        if (t[i] == ' ')
-            return ' ';
-    return 'D';
+    board_t b;
+    board_from_table(&b, t);
+    return board_check_win(&b);
 }
 
 double calculate_win_value(char win, char player)
@@ -72,16 +36,40 @@ double calculate_win_value(char win, char player)
     return 0.5;
 }
 
-int *available_moves(const char *table)
+int move_budget;
+
+void move_stats_add(move_stats_t *stats, uint64_t usec)
+{
+    if (stats->n_moves < MAX_GRIDS)
+        stats->usec[stats->n_moves++] = usec;
+}
+
+static int cmp_usec(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+void move_stats_report(move_stats_t *stats)
 {
-    int *moves = malloc(N_GRIDS * sizeof(int));
-    int m = 0;
-    for (int i = 0; i < N_GRIDS; i++)
-        if (table[i] == ' ')
-            moves[m++] = i;
-    if (m < N_GRIDS)
-        moves[m] = -1;
-    return moves;
+    int n = stats->n_moves;
+    if (!n)
+        return;
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += stats->usec[i];
+    qsort(stats->usec, n, sizeof(stats->usec[0]), cmp_usec);
+    printf("%s: %d moves, mean %.1f ms, median %.1f ms, max %.1f ms\n",
+           stats->name, n, sum / 1e3 / n, stats->usec[n / 2] / 1e3,
+           stats->usec[n - 1] / 1e3);
+    stats->n_moves = 0;
+}
+
+int available_moves(const char *table, int moves[MAX_GRIDS])
+{
+    board_t b;
+    board_from_table(&b, table);
+    return board_moves(board_empty(&b), moves);
 }
 
 void draw_board(const char *t)
@@ -137,3 +125,162 @@ void draw_board(const char *t)
         printf(" %2c", 'A' + i);
     printf("\n");
 }
+
+/* The engines below are built from game_variant.h for each variant, with the
+ * board size, goal and line masks known at compile time.  The helpers they
+ * share are forced inline so that these constants fold into each of them.
+ * Along a line, a segment of GOAL grids is found from the grid it starts at:
+ * its marks are the ones shift, 2 * shift, ... bits above.
+ */
+#define FOLD static inline __attribute__((always_inline))
+
+static const int powers_of_ten[MAX_BOARD_SIZE + 1] = {
+    0, 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+static inline int popcount(uint64_t m)
+{
+#if defined(__POPCNT__) || defined(__aarch64__)
+    return __builtin_popcountll(m);
+#else
+    m -= (m >> 1) & 0x5555555555555555ULL;
+    m = (m & 0x3333333333333333ULL) + ((m >> 2) & 0x3333333333333333ULL);
+    m = (m + (m >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (m * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/* The grids of m and the goal - 1 following each along a line */
+FOLD uint64_t spread(uint64_t m, int shift, int goal)
+{
+    uint64_t spread = m;
+    for (int k = 1; k < goal; k++)
+        spread |= m >> (k * shift);
+    return spread;
+}
+
+/* Grids starting a segment of player mask m which wins: starts holds the
+ * grids a segment fits from and step those with a next grid on the line.
+ */
+FOLD uint64_t segments(uint64_t m,
+                       int shift,
+                       uint64_t starts,
+                       uint64_t step,
+                       int goal)
+{
+    uint64_t run = m & starts;
+    for (int k = 1; k < goal; k++)
+        run &= m >> (k * shift);
+#if !ALLOW_EXCEED
+    /* Neither the grid before nor the one after may extend the segment */
+    run &= ~((m & step) << shift);
+    run &= ~((m >> (goal * shift)) & (step >> ((goal - 1) * shift)));
+#else
+    (void) step;
+#endif
+    return run;
+}
+
+/* Segments holding exactly k of the marks of m, for each k up to goal, as
+ * masks of the grids they start from
+ */
+FOLD void count_segments(uint64_t m,
+                         int shift,
+                         uint64_t starts,
+                         int goal,
+                         uint64_t *exactly)
+{
+    exactly[0] = starts;
+    for (int k = 1; k <= goal; k++)
+        exactly[k] = 0;
+    for (int k = 0; k < goal; k++) {
+        uint64_t marked = m >> (k * shift);
+        for (int v = k + 1; v > 0; v--)
+            exactly[v] = (exactly[v] & ~marked) | (exactly[v - 1] & marked);
+        exactly[0] &= ~marked;
+    }
+}
+
+/* Sum over the segments along a line holding marks of a single player of
+ * 10^(k - 1) for k marks, counted positive for mine and negative for theirs
+ */
+FOLD int line_score(uint64_t mine,
+                    uint64_t theirs,
+                    int shift,
+                    uint64_t starts,
+                    int goal)
+{
+    uint64_t m[MAX_BOARD_SIZE + 1], t[MAX_BOARD_SIZE + 1];
+    count_segments(mine, shift, starts, goal, m);
+    count_segments(theirs, shift, starts, goal, t);
+    int score = 0;
+    for (int k = 1; k <= goal; k++)
+        score += powers_of_ten[k] *
+                 (popcount(m[k] & t[0]) - popcount(t[k] & m[0]));
+    return score;
+}
+
+#define V__(name, size, goal) name##_##size##_##goal
+#define V_(name, size, goal) V__(name, size, goal)
+#define V(name) V_(name, BOARD_SIZE, GOAL)
+
+#undef BOARD_SIZE
+#undef GOAL
+
+#define BOARD_SIZE 3
+#define GOAL 3
+#include "game_variant.h"
+
+#define BOARD_SIZE 4
+#define GOAL 3
+#include "game_variant.h"
+
+#define BOARD_SIZE 4
+#define GOAL 4
+#include "game_variant.h"
+
+#define BOARD_SIZE 5
+#define GOAL 4
+#include "game_variant.h"
+
+#define BOARD_SIZE 6
+#define GOAL 4
+#include "game_variant.h"
+
+#define BOARD_SIZE 6
+#define GOAL 5
+#include "game_variant.h"
+
+#define BOARD_SIZE 7
+#define GOAL 5
+#include "game_variant.h"
+
+#define BOARD_SIZE 8
+#define GOAL 5
+#include "game_variant.h"
+
+static const game_t *const variants[] = {
+    &game_3_3, &game_4_3, &game_4_4, &game_5_4,
+    &game_6_4, &game_6_5, &game_7_5, &game_8_5,
+};
+
+const game_t *game = &game_4_3;
+
+bool game_select(int board_size, int goal)
+{
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        if (variants[i]->board_size == board_size &&
+            variants[i]->goal == goal) {
+            game = variants[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const game_t *game_variant(int i)
+{
+    if (i < 0 || i >= (int) (sizeof(variants) / sizeof(variants[0])))
+        return NULL;
+    return variants[i];
+}
@@ -1,7 +1,15 @@
 #pragma once
 
-#define BOARD_SIZE 4
-#define GOAL 3
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Largest board whose positions fit in a 64-bit mask */
+#define MAX_BOARD_SIZE 8
+#define MAX_GRIDS (MAX_BOARD_SIZE * MAX_BOARD_SIZE)
+
+/* Board size and goal of the variant selected by game_select() */
+#define BOARD_SIZE (game->board_size)
+#define GOAL (game->goal)
 #define ALLOW_EXCEED 1
 #define N_GRIDS (BOARD_SIZE * BOARD_SIZE)
 #define GET_INDEX(i, j) ((i) * (BOARD_SIZE) + (j))
@@ -19,9 +27,105 @@ typedef struct {
 
 enum game_mode { PVE, EVE };
 
-extern const line_t lines[4];
+/* Position as one bit mask per player, 'O' first: bit GET_INDEX(i, j) of a
+ * mask is set when the player has a mark on that grid.
+ */
+typedef struct {
+    uint64_t mask[2];
+} board_t;
+
+#define PLAYER_INDEX(player) ((player) == 'X')
+
+/* The n lowest bits set, for n from 1 to 64 */
+#define LOW_BITS(n) (((1ULL << ((n) - 1)) << 1) - 1)
+#define GRIDS_MASK LOW_BITS(N_GRIDS)
+
+/* Engine built for one board size and goal.  See game.c */
+typedef struct {
+    int board_size, goal;
+    line_t lines[4];
+    char (*check_win)(const board_t *b);
+    char (*move_result)(const board_t *b, int move, char player);
+    int (*score)(const board_t *b, char player);
+} game_t;
+
+extern const game_t *game;
+
+/* Play on a board_size x board_size board, won by goal marks in a row.
+ * Return false, keeping the current variant, if no engine was built for it.
+ */
+bool game_select(int board_size, int goal);
+
+/* The i-th variant built in, NULL past the last one */
+const game_t *game_variant(int i);
+
+static inline void board_play(board_t *b, int move, char player)
+{
+    b->mask[PLAYER_INDEX(player)] |= 1ULL << move;
+}
+
+static inline void board_undo(board_t *b, int move, char player)
+{
+    b->mask[PLAYER_INDEX(player)] &= ~(1ULL << move);
+}
+
+static inline uint64_t board_empty(const board_t *b)
+{
+    return ~(b->mask[0] | b->mask[1]) & GRIDS_MASK;
+}
+
+/* Store the grids set in mask in moves and return their number */
+static inline int board_moves(uint64_t mask, int moves[MAX_GRIDS])
+{
+    int n = 0;
+    for (; mask; mask &= mask - 1)
+        moves[n++] = __builtin_ctzll(mask);
+    return n;
+}
+
+void board_from_table(board_t *b, const char *t);
+
+static inline char board_check_win(const board_t *b)
+{
+    return game->check_win(b);
+}
+
+/* Outcome of the game once player has played move, the grid last marked:
+ * player when it completes a segment, 'D' when the board is full, else ' '.
+ * Only the segments through move are looked at, so the position before it
+ * must not have been decided already.
+ */
+static inline char board_move_result(const board_t *b, int move, char player)
+{
+    return game->move_result(b, move, player);
+}
+
+static inline int board_score(const board_t *b, char player)
+{
+    return game->score(b, player);
+}
+
+/* Microseconds an agent may think about each move, 0 for a fixed amount of
+ * work however long it takes
+ */
+extern int move_budget;
+
+/* How long the moves of an agent took over a game */
+typedef struct {
+    const char *name;
+    int n_moves;
+    uint64_t usec[MAX_GRIDS];
+} move_stats_t;
+
+void move_stats_add(move_stats_t *stats, uint64_t usec);
+
+/* Print the count, mean, median and longest of the moves, and start over */
+void move_stats_report(move_stats_t *stats);
 
-int *available_moves(const char *table);
+/* Store the empty grids of table in moves, in increasing order, and return
+ * their number.  No memory is allocated.
+ */
+int available_moves(const char *table, int moves[MAX_GRIDS]);
 char check_win(char *t);
 double calculate_win_value(char win, char player);
 void draw_board(const char *t);
@@ -0,0 +1,94 @@
+/* Engine for one board size and goal, included by game.c once per variant
+ * with BOARD_SIZE and GOAL defined as constants.  Everything it defines is
+ * named after the variant through V(), e.g. check_win_4_3 for 4x4 boards
+ * won by 3 in a row, and its line shifts and masks are constant-folded.
+ */
+
+_Static_assert(BOARD_SIZE <= MAX_BOARD_SIZE, "Board must fit in a mask");
+_Static_assert(BOARD_SIZE > 1, "Board size must be greater than 1");
+_Static_assert(GOAL <= BOARD_SIZE, "Goal must not be greater than board size");
+_Static_assert(GOAL > 0, "Goal must be greater than 0");
+
+/* Along each of lines[], the distance between consecutive grids in a mask,
+ * and the grids from which steps more grids along the line stay on the board
+ */
+#define SHIFT(i_line)                 \
+    ((i_line) == 0   ? BOARD_SIZE     \
+     : (i_line) == 1 ? 1              \
+     : (i_line) == 2 ? BOARD_SIZE + 1 \
+                     : BOARD_SIZE - 1)
+#define SPAN (BOARD_SIZE - GOAL + 1)
+#define FIRST_ROWS(n) LOW_BITS((n) * BOARD_SIZE)
+#define EACH_ROW(n) (FIRST_ROWS(n) / LOW_BITS(BOARD_SIZE))
+#define REACH(i_line, steps)                                           \
+    ((i_line) == 0 ? FIRST_ROWS(BOARD_SIZE - (steps))                  \
+     : (i_line) == 1                                                   \
+         ? EACH_ROW(BOARD_SIZE) * LOW_BITS(BOARD_SIZE - (steps))       \
+     : (i_line) == 2                                                   \
+         ? EACH_ROW(BOARD_SIZE - (steps)) * LOW_BITS(BOARD_SIZE - (steps)) \
+         : EACH_ROW(BOARD_SIZE - (steps)) *                            \
+               (LOW_BITS(BOARD_SIZE - (steps)) << (steps)))
+#define LINE(i_line) \
+    SHIFT(i_line), REACH(i_line, GOAL - 1), REACH(i_line, 1), GOAL
+
+#define SEGMENTS(m)                                \
+    (segments(m, LINE(0)) | segments(m, LINE(1)) | \
+     segments(m, LINE(2)) | segments(m, LINE(3)))
+
+static char V(check_win)(const board_t *b)
+{
+    if (SEGMENTS(b->mask[0]))
+        return 'O';
+    if (SEGMENTS(b->mask[1]))
+        return 'X';
+    return board_empty(b) ? ' ' : 'D';
+}
+
+static char V(move_result)(const board_t *b, int move, char player)
+{
+    uint64_t m = b->mask[PLAYER_INDEX(player)];
+    uint64_t grid = 1ULL << move;
+    if ((segments(m, LINE(0)) & spread(grid, SHIFT(0), GOAL)) ||
+        (segments(m, LINE(1)) & spread(grid, SHIFT(1), GOAL)) ||
+        (segments(m, LINE(2)) & spread(grid, SHIFT(2), GOAL)) ||
+        (segments(m, LINE(3)) & spread(grid, SHIFT(3), GOAL)))
+        return player;
+    return board_empty(b) ? ' ' : 'D';
+}
+
+static int V(score)(const board_t *b, char player)
+{
+    uint64_t mine = b->mask[PLAYER_INDEX(player)];
+    uint64_t theirs = b->mask[!PLAYER_INDEX(player)];
+    int score = 0;
+    score += line_score(mine, theirs, SHIFT(0), REACH(0, GOAL - 1), GOAL);
+    score += line_score(mine, theirs, SHIFT(1), REACH(1, GOAL - 1), GOAL);
+    score += line_score(mine, theirs, SHIFT(2), REACH(2, GOAL - 1), GOAL);
+    score += line_score(mine, theirs, SHIFT(3), REACH(3, GOAL - 1), GOAL);
+    return score;
+}
+
+static const game_t V(game) = {
+    .board_size = BOARD_SIZE,
+    .goal = GOAL,
+    .lines =
+        {
+            {1, 0, 0, 0, SPAN, BOARD_SIZE},          // ROW
+            {0, 1, 0, 0, BOARD_SIZE, SPAN},          // COL
+            {1, 1, 0, 0, SPAN, SPAN},                // PRIMARY
+            {1, -1, 0, GOAL - 1, SPAN, BOARD_SIZE},  // SECONDARY
+        },
+    .check_win = V(check_win),
+    .move_result = V(move_result),
+    .score = V(score),
+};
+
+#undef SEGMENTS
+#undef LINE
+#undef REACH
+#undef EACH_ROW
+#undef FIRST_ROWS
+#undef SPAN
+#undef SHIFT
+#undef GOAL
+#undef BOARD_SIZE
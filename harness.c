@@ -43,10 +43,14 @@ typedef struct __block_element {
 
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Most payload bytes allocated at a time, 0 for no limit */
+int alloc_limit = 0;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
@@ -142,6 +146,15 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
+    if (alloc_limit > 0 && (allocated_bytes > (size_t) alloc_limit ||
+                            size > (size_t) alloc_limit - allocated_bytes)) {
+        report_event(MSG_WARN,
+                     "Allocation of %zu bytes exceeds limit of %d bytes, "
+                     "returning NULL",
+                     size, alloc_limit);
+        return NULL;
+    }
+
     block_element_t *new_block =
         malloc(size + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
@@ -165,6 +178,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    allocated_bytes += size;
 
     return p;
 }
@@ -220,6 +234,7 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
+    allocated_bytes -= b->payload_size;
     free(b);
     allocated_count--;
 }
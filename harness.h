@@ -24,6 +24,9 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Limit on bytes held by the tested code.  Allocations beyond it fail */
+extern int alloc_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -0,0 +1,148 @@
+/* Zero-copy parser for HTTP request heads.
+ *
+ * Lines are located with memchr and parsed where they lie; each line is only
+ * looked at once its terminating newline has arrived, so a request that is
+ * still incomplete is never reported as malformed.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+
+/* End of the line ending at the newline eol, without the optional CR */
+static const char *line_end(const char *line, const char *eol)
+{
+    return (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static bool slice_is(const char *p, size_t len, const char *word)
+{
+    return len == strlen(word) && !strncasecmp(p, word, len);
+}
+
+/* Request line: method SP target [SP HTTP/x.y] */
+static http_parse_status_t parse_request_line(const char *p,
+                                              const char *end,
+                                              http_request_t *req)
+{
+    const char *sp = memchr(p, ' ', end - p);
+    if (!sp || sp == p)
+        return HTTP_PARSE_BAD;
+    req->method = (http_slice_t){.ptr = p, .len = sp - p};
+
+    p = skip_space(sp, end);
+    sp = memchr(p, ' ', end - p);
+    const char *target_end = sp ? sp : end;
+    if (target_end == p)
+        return HTTP_PARSE_BAD;
+    req->target = (http_slice_t){.ptr = p, .len = target_end - p};
+
+    /* The target becomes a command line: no control characters */
+    for (; p < target_end; p++)
+        if ((unsigned char) *p < 0x20 || *p == 0x7f)
+            return HTTP_PARSE_BAD;
+
+    p = skip_space(target_end, end);
+    if (p == end) {
+        req->version = 9;
+        req->keep_alive = false;
+        return HTTP_PARSE_OK;
+    }
+    if (end - p != 8 || memcmp(p, "HTTP/1.", 7) || p[7] < '0' || p[7] > '9')
+        return HTTP_PARSE_BAD;
+    req->version = 10 + (p[7] - '0');
+    /* Persistent by default from HTTP/1.1 on */
+    req->keep_alive = req->version >= 11;
+    return HTTP_PARSE_OK;
+}
+
+/* Header field: name ":" OWS value OWS */
+static http_parse_status_t parse_field(const char *p,
+                                       const char *end,
+                                       http_request_t *req)
+{
+    const char *colon = memchr(p, ':', end - p);
+    if (!colon || colon == p || memchr(p, ' ', colon - p) ||
+        memchr(p, '\t', colon - p))
+        return HTTP_PARSE_BAD;
+
+    if (!slice_is(p, colon - p, "Connection"))
+        return HTTP_PARSE_OK;
+
+    /* Comma separated list of options */
+    p = colon + 1;
+    while (p < end) {
+        p = skip_space(p, end);
+        const char *comma = memchr(p, ',', end - p);
+        const char *token_end = comma ? comma : end;
+        const char *q = token_end;
+        while (q > p && (q[-1] == ' ' || q[-1] == '\t'))
+            q--;
+        if (slice_is(p, q - p, "close"))
+            req->keep_alive = false;
+        else if (slice_is(p, q - p, "keep-alive"))
+            req->keep_alive = true;
+        p = comma ? comma + 1 : end;
+    }
+    return HTTP_PARSE_OK;
+}
+
+http_parse_status_t http_parse_request(const char *buf,
+                                       size_t len,
+                                       size_t max_head,
+                                       http_request_t *req)
+{
+    const char *p = buf;
+    const char *end = buf + (len < max_head ? len : max_head);
+    /* Running out of data is final once the limit has been reached */
+    http_parse_status_t incomplete =
+        len < max_head ? HTTP_PARSE_INCOMPLETE : HTTP_PARSE_HEAD_TOO_LONG;
+
+    /* Tolerate empty lines ahead of the request line (RFC 7230, 3.5) */
+    while (p < end) {
+        if (*p == '\n')
+            p++;
+        else if (*p == '\r' && p + 1 < end && p[1] == '\n')
+            p += 2;
+        else
+            break;
+    }
+
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol) {
+        if (end - p >= HTTP_MAX_REQUEST_LINE)
+            return HTTP_PARSE_URI_TOO_LONG;
+        return incomplete;
+    }
+    if (eol - p >= HTTP_MAX_REQUEST_LINE)
+        return HTTP_PARSE_URI_TOO_LONG;
+
+    http_parse_status_t status =
+        parse_request_line(p, line_end(p, eol), req);
+    if (status != HTTP_PARSE_OK)
+        return status;
+
+    /* Header fields, up to the empty line ending the head */
+    for (p = eol + 1;; p = eol + 1) {
+        eol = memchr(p, '\n', end - p);
+        if (!eol)
+            return incomplete;
+        const char *le = line_end(p, eol);
+        if (le == p)
+            break;
+        status = parse_field(p, le, req);
+        if (status != HTTP_PARSE_OK)
+            return status;
+    }
+
+    req->head_len = eol + 1 - buf;
+    return HTTP_PARSE_OK;
+}
@@ -0,0 +1,46 @@
+#ifndef LAB0_HTTP_PARSER_H
+#define LAB0_HTTP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* In-place parser for the head (request line and header fields) of an HTTP
+ * request.  Nothing is copied: the parsed fields point into the caller's
+ * buffer and remain valid as long as the buffer is left untouched.
+ */
+
+/* Longest request line accepted */
+#define HTTP_MAX_REQUEST_LINE 1024
+
+typedef enum {
+    HTTP_PARSE_OK,            /* Complete, well-formed request head */
+    HTTP_PARSE_INCOMPLETE,    /* Need more data */
+    HTTP_PARSE_BAD,           /* Malformed: 400 Bad Request */
+    HTTP_PARSE_URI_TOO_LONG,  /* Request line too long: 414 */
+    HTTP_PARSE_HEAD_TOO_LONG, /* Head does not fit the limit: 431 */
+} http_parse_status_t;
+
+/* Part of the parsed buffer */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} http_slice_t;
+
+typedef struct {
+    http_slice_t method;
+    http_slice_t target;
+    int version;     /* 10 for HTTP/1.0, 11 for HTTP/1.1, 9 when absent */
+    bool keep_alive; /* From the version and the Connection header */
+    size_t head_len; /* Bytes up to and including the blank line */
+} http_request_t;
+
+/* Parse the request head at the start of buf, which holds len bytes.  A head
+ * that is not complete within max_head bytes is rejected as soon as that is
+ * evident, as is an overlong request line, without waiting for more data.
+ */
+http_parse_status_t http_parse_request(const char *buf,
+                                       size_t len,
+                                       size_t max_head,
+                                       http_request_t *req);
+
+#endif /* LAB0_HTTP_PARSER_H */
@@ -0,0 +1,297 @@
+/* Throughput benchmark and fuzzer for the HTTP request parser.
+ *
+ *   http_parse_bench [-n MB]        parse MB megabytes of pipelined requests
+ *   http_parse_bench -f N [-s SEED] check invariants on N mutated requests
+ *
+ * The benchmark also runs the previous line-by-line sscanf() parser over the
+ * same data for comparison.  Build with SANITIZER=1 when fuzzing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_parser.h"
+
+#define MAX_HEAD 8192
+
+static const char *corpus[] = {
+    "GET /it/RAND HTTP/1.1\r\nHost: localhost:9999\r\nUser-Agent: "
+    "curl/7.88.1\r\nAccept: */*\r\n\r\n",
+    "GET /show HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+    "GET /ih/hello%20world/3 HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+    "GET /sort?x=1 HTTP/1.1\r\nHost: localhost:9999\r\nConnection: "
+    "Upgrade, close\r\nRange: bytes=0-99\r\n\r\n",
+    "GET /size HTTP/1.1\r\nHost: localhost:9999\r\nUser-Agent: Mozilla/5.0 "
+    "(X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\nAccept: "
+    "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "DNT: 1\r\nConnection: keep-alive\r\nUpgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\nSec-Fetch-Mode: navigate\r\n\r\n",
+    "GET /rh\n\n",
+};
+
+#define N_CORPUS (sizeof(corpus) / sizeof(corpus[0]))
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+    /* xorshift64 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The parser web.c used before: copy each line out of the buffer and run
+ * sscanf() on it.
+ */
+static size_t legacy_parse(const char *buf, size_t len, unsigned long *sink)
+{
+    char line[1024], method[1024], uri[1024];
+    const char *p = buf, *end = buf + len;
+    bool first = true;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            return 0;
+        size_t n = eol - p;
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol + 1;
+        if (first) {
+            if (sscanf(line, "%1023s %1023s", method, uri) != 2)
+                return 0;
+            first = false;
+            *sink += strlen(uri);
+        } else if (line[0] == '\0' || (line[0] == '\r' && line[1] == '\0')) {
+            return p - buf;
+        } else if (line[0] == 'R' && line[1] == 'a' && line[2] == 'n') {
+            unsigned long offset = 0, last = 0;
+            sscanf(line, "Range: bytes=%lu-%lu", &offset, &last);
+            *sink += offset + last;
+        }
+    }
+    return 0;
+}
+
+/* Concatenate random corpus requests, as a pipelining client would */
+static char *build_stream(size_t size, size_t *total, size_t *count)
+{
+    char *buf = malloc(size + MAX_HEAD);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t len = 0;
+    *count = 0;
+    while (len < size) {
+        const char *req = corpus[rng() % N_CORPUS];
+        size_t n = strlen(req);
+        memcpy(buf + len, req, n);
+        len += n;
+        (*count)++;
+    }
+    *total = len;
+    return buf;
+}
+
+static void bench(size_t megabytes)
+{
+    size_t total, count;
+    char *buf = build_stream(megabytes << 20, &total, &count);
+
+    double start = now();
+    size_t pos = 0, target_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        http_request_t req;
+        if (http_parse_request(buf + pos, total - pos, MAX_HEAD, &req) !=
+            HTTP_PARSE_OK) {
+            fprintf(stderr, "request %zu failed to parse\n", i);
+            exit(1);
+        }
+        target_bytes += req.target.len;
+        pos += req.head_len;
+    }
+    double elapsed = now() - start;
+    printf("http_parse_request: %zu requests, %.1f MB in %.3f sec: "
+           "%.1f MB/s, %.2f M requests/s\n",
+           count, total / 1e6, elapsed, total / 1e6 / elapsed,
+           count / 1e6 / elapsed);
+
+    start = now();
+    unsigned long sink = 0;
+    pos = 0;
+    for (size_t i = 0; i < count; i++)
+        pos += legacy_parse(buf + pos, total - pos, &sink);
+    elapsed = now() - start;
+    printf("sscanf line parser: %zu requests, %.1f MB in %.3f sec: "
+           "%.1f MB/s, %.2f M requests/s\n",
+           count, total / 1e6, elapsed, total / 1e6 / elapsed,
+           count / 1e6 / elapsed);
+
+    /* Keep the work from being optimized away */
+    if (target_bytes == 0 || sink == 0)
+        printf("(%zu %lu)\n", target_bytes, sink);
+    free(buf);
+}
+
+static void fail(const char *what, const char *buf, size_t len)
+{
+    fprintf(stderr, "FAIL: %s on input of %zu bytes:\n", what, len);
+    fwrite(buf, 1, len, stderr);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static void check_slice(http_slice_t s, const char *buf, size_t len)
+{
+    if (s.ptr < buf || s.ptr + s.len > buf + len || !s.len)
+        fail("slice outside of the input", buf, len);
+}
+
+static void mutate(char *buf, size_t *len, size_t cap)
+{
+    static const char special[] = "\r\n :/%?,\t\0\x7f";
+    int rounds = 1 + rng() % 4;
+    for (int r = 0; r < rounds; r++) {
+        size_t pos = *len ? rng() % *len : 0;
+        switch (rng() % 6) {
+        case 0: /* flip a byte */
+            if (*len)
+                buf[pos] = rng();
+            break;
+        case 1: /* plant a delimiter */
+            if (*len)
+                buf[pos] = special[rng() % (sizeof(special) - 1)];
+            break;
+        case 2: /* truncate */
+            *len = pos;
+            break;
+        case 3: /* delete a run */
+            if (*len) {
+                size_t n = 1 + rng() % (*len - pos);
+                memmove(buf + pos, buf + pos + n, *len - pos - n);
+                *len -= n;
+            }
+            break;
+        case 4: /* repeat a run, now and then many times */
+        case 5: {
+            size_t n = *len ? 1 + rng() % (*len - pos) : 0;
+            int copies = rng() % 8 ? 1 : 64;
+            for (int k = 0; k < copies && *len + n <= cap; k++) {
+                memmove(buf + pos + n, buf + pos, *len - pos);
+                *len += n;
+            }
+            break;
+        }
+        }
+    }
+}
+
+static void fuzz(long iterations)
+{
+    size_t cap = 4 * MAX_HEAD;
+    char *buf = malloc(cap);
+    long counts[HTTP_PARSE_HEAD_TOO_LONG + 1] = {0};
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (long it = 0; it < iterations; it++) {
+        const char *seed = corpus[rng() % N_CORPUS];
+        size_t len = strlen(seed);
+        memcpy(buf, seed, len);
+        mutate(buf, &len, cap);
+
+        /* Exact-size copy so that sanitizers catch reads past the end */
+        char *input = malloc(len ? len : 1);
+        memcpy(input, buf, len);
+
+        http_request_t req;
+        http_parse_status_t status =
+            http_parse_request(input, len, MAX_HEAD, &req);
+        if (status > HTTP_PARSE_HEAD_TOO_LONG)
+            fail("unknown status", input, len);
+        counts[status]++;
+
+        if (status == HTTP_PARSE_OK) {
+            if (req.head_len > len || req.head_len > MAX_HEAD)
+                fail("head beyond the input", input, len);
+            check_slice(req.method, input, req.head_len);
+            check_slice(req.target, input, req.head_len);
+            /* Nothing short of the whole head is a complete request */
+            size_t cut = rng() % req.head_len;
+            http_request_t partial;
+            if (http_parse_request(input, cut, MAX_HEAD, &partial) !=
+                HTTP_PARSE_INCOMPLETE)
+                fail("prefix of a request is not incomplete", input, len);
+            /* Trailing data must not matter */
+            if (http_parse_request(input, req.head_len, MAX_HEAD, &partial) !=
+                    HTTP_PARSE_OK ||
+                partial.head_len != req.head_len)
+                fail("request depends on trailing data", input, len);
+        } else if (status == HTTP_PARSE_INCOMPLETE && len >= MAX_HEAD) {
+            fail("incomplete beyond the limit", input, len);
+        }
+        free(input);
+    }
+
+    printf("%ld inputs: %ld ok, %ld incomplete, %ld bad, %ld uri too long, "
+           "%ld head too long\n",
+           iterations, counts[HTTP_PARSE_OK], counts[HTTP_PARSE_INCOMPLETE],
+           counts[HTTP_PARSE_BAD], counts[HTTP_PARSE_URI_TOO_LONG],
+           counts[HTTP_PARSE_HEAD_TOO_LONG]);
+    free(buf);
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-n MB] [-f N] [-s SEED]\n", cmd);
+    printf("\t-h\tPrint this information\n");
+    printf("\t-n MB\tMegabytes of requests to parse (default 64)\n");
+    printf("\t-f N\tFuzz N mutated requests instead of benchmarking\n");
+    printf("\t-s SEED\tSeed for generating inputs\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long megabytes = 64, iterations = 0;
+    int c;
+    while ((c = getopt(argc, argv, "hn:f:s:")) != -1) {
+        switch (c) {
+        case 'n':
+            megabytes = atol(optarg);
+            break;
+        case 'f':
+            iterations = atol(optarg);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (iterations > 0)
+        fuzz(iterations);
+    else
+        bench(megabytes > 0 ? megabytes : 64);
+    return 0;
+}
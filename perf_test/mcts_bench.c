@@ -0,0 +1,149 @@
+/* Scaling benchmark for parallel MCTS.
+ *
+ *   mcts_bench [-t THREADS] [-g GAMES] [-b SIZE -k GOAL] [-s SEED]
+ *
+ * Times the search of the first move of a game with 1 to THREADS
+ * threads, each way of sharing the work among them, and reports playouts
+ * per second.  Then has the agent with THREADS threads play GAMES games
+ * against the single-threaded one, each taking turns to go first, and
+ * reports how they fared.  Both spend ITERATIONS playouts on every move,
+ * seeded with SEED so that runs can be compared.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agents/mcts.h"
+#include "game.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *mode_name(int tree_parallel)
+{
+    return tree_parallel ? "tree" : "root";
+}
+
+static void bench_scaling(int max_threads)
+{
+    for (int tree_parallel = 0; tree_parallel <= 1; tree_parallel++) {
+        double base = 0;
+        for (int threads = 1; threads <= max_threads; threads++) {
+            char table[MAX_GRIDS];
+            memset(table, ' ', N_GRIDS);
+            mcts_threads = threads;
+            mcts_tree_parallel = tree_parallel;
+            double start = now();
+            mcts(table, 'O', 0);
+            double rate = ITERATIONS / (now() - start);
+            if (threads == 1)
+                base = rate;
+            printf("%s parallel, %2d threads: %.0f playouts/s (x%.2f)\n",
+                   mode_name(tree_parallel), threads, rate, rate / base);
+        }
+    }
+}
+
+/* Play a game, the agent with threads threads being first if first is set.
+ * Return 1 if it won, -1 if it lost, 0 for a draw.
+ */
+static int play(int threads, int tree_parallel, int first)
+{
+    char table[MAX_GRIDS];
+    memset(table, ' ', N_GRIDS);
+    char turn = 'O';
+    bool parallel = first;
+    char win;
+    while ((win = check_win(table)) == ' ') {
+        mcts_threads = parallel ? threads : 1;
+        mcts_tree_parallel = tree_parallel;
+        table[mcts(table, turn, 0)] = turn;
+        turn ^= 'O' ^ 'X';
+        parallel = !parallel;
+    }
+    if (win == 'D')
+        return 0;
+    /* The player to move lost */
+    return parallel ? 1 : -1;
+}
+
+static void bench_games(int threads, int games)
+{
+    for (int tree_parallel = 0; tree_parallel <= 1; tree_parallel++) {
+        int won = 0, drawn = 0, lost = 0;
+        for (int g = 0; g < games; g++) {
+            int result = play(threads, tree_parallel, g & 1);
+            won += result > 0;
+            drawn += !result;
+            lost += result < 0;
+        }
+        printf("%s parallel, %d threads against 1: %d won, %d drawn, %d lost\n",
+               mode_name(tree_parallel), threads, won, drawn, lost);
+    }
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-t THREADS] [-g GAMES] [-b SIZE -k GOAL] "
+           "[-s SEED]\n",
+           cmd);
+    printf("\t-h\tPrint this information\n");
+    printf("\t-t THREADS\tMost threads to search with (default: CPUs)\n");
+    printf("\t-g GAMES\tGames to play against one thread (default 20)\n");
+    printf("\t-b SIZE\tBoard size (default %d)\n", BOARD_SIZE);
+    printf("\t-k GOAL\tMarks in a row to win (default %d)\n", GOAL);
+    printf("\t-s SEED\tSeed of the playouts (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int games = 20;
+    int size = BOARD_SIZE, goal = GOAL;
+    int c;
+    mcts_seed = 1;
+    while ((c = getopt(argc, argv, "ht:g:b:k:s:")) != -1) {
+        switch (c) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'g':
+            games = atoi(optarg);
+            break;
+        case 'b':
+            size = atoi(optarg);
+            break;
+        case 'k':
+            goal = atoi(optarg);
+            break;
+        case 's':
+            mcts_seed = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!game_select(size, goal)) {
+        fprintf(stderr, "No engine for %dx%d boards won by %d in a row\n",
+                size, size, goal);
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > MCTS_MAX_THREADS)
+        threads = MCTS_MAX_THREADS;
+
+    bench_scaling(threads);
+    bench_games(threads, games);
+    mcts_free();
+    return 0;
+}
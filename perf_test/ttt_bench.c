@@ -0,0 +1,238 @@
+/* Position evaluation benchmark for the tic-tac-toe engine.
+ *
+ *   ttt_bench [-n N] [-s SEED]    evaluate N random positions (in millions)
+ *                                 on the boards of every variant
+ *
+ * Each position is checked for a win and scored for both players, by the
+ * bitboard engine of game.c, through its char-array adapters, and by the
+ * previous grid-scanning code.  All three must agree on every position, and
+ * with the outcome found from the segments through the last move alone.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agents/util.h"
+#include "game.h"
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+    /* xorshift64 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The check_win() and get_score() game.c and agents/util.h had before:
+ * walk every segment of every line grid by grid.  Lines longer than GOAL
+ * win, as with the default ALLOW_EXCEED.
+ */
+static char legacy_segment_win(const char *t, int i, int j, line_t line)
+{
+    char last = t[GET_INDEX(i, j)];
+    if (last == ' ')
+        return ' ';
+    for (int k = 1; k < GOAL; k++) {
+        if (last != t[GET_INDEX(i + k * line.i_shift, j + k * line.j_shift)])
+            return ' ';
+    }
+    return last;
+}
+
+static char legacy_check_win(const char *t)
+{
+    for (int i_line = 0; i_line < 4; ++i_line) {
+        line_t line = game->lines[i_line];
+        for (int i = line.i_lower_bound; i < line.i_upper_bound; ++i) {
+            for (int j = line.j_lower_bound; j < line.j_upper_bound; ++j) {
+                char win = legacy_segment_win(t, i, j, line);
+                if (win != ' ')
+                    return win;
+            }
+        }
+    }
+    for (int i = 0; i < N_GRIDS; i++)
+        if (t[i] == ' ')
+            return ' ';
+    return 'D';
+}
+
+static int legacy_segment_score(const char *t,
+                                char player,
+                                int i,
+                                int j,
+                                line_t line)
+{
+    int score = 0;
+    for (int k = 0; k < GOAL; k++) {
+        char curr = t[GET_INDEX(i + k * line.i_shift, j + k * line.j_shift)];
+        if (curr == player) {
+            if (score < 0)
+                return 0;
+            score = score ? score * 10 : 1;
+        } else if (curr != ' ') {
+            if (score > 0)
+                return 0;
+            score = score ? score * 10 : -1;
+        }
+    }
+    return score;
+}
+
+static int legacy_get_score(const char *t, char player)
+{
+    int score = 0;
+    for (int i_line = 0; i_line < 4; ++i_line) {
+        line_t line = game->lines[i_line];
+        for (int i = line.i_lower_bound; i < line.i_upper_bound; ++i) {
+            for (int j = line.j_lower_bound; j < line.j_upper_bound; ++j)
+                score += legacy_segment_score(t, player, i, j, line);
+        }
+    }
+    return score;
+}
+
+/* Positions met in random games, up to and including their last move, and
+ * the move leading to each
+ */
+static char *random_positions(size_t count, int *last)
+{
+    char *tables = malloc(count * N_GRIDS);
+    size_t n = 0;
+
+    while (n < count) {
+        char t[MAX_GRIDS];
+        memset(t, ' ', N_GRIDS);
+        char player = 'O';
+        for (int moves = 0; moves < N_GRIDS && n < count; moves++) {
+            int move;
+            do
+                move = rng() % N_GRIDS;
+            while (t[move] != ' ');
+            t[move] = player;
+            player ^= 'O' ^ 'X';
+            last[n] = move;
+            memcpy(tables + n++ * N_GRIDS, t, N_GRIDS);
+            if (legacy_check_win(t) != ' ')
+                break;
+        }
+    }
+    return tables;
+}
+
+static void report(const char *what, size_t count, double elapsed)
+{
+    printf("%-18s %zu positions in %.3f sec: %.2f M positions/s\n", what,
+           count, elapsed, count / 1e6 / elapsed);
+}
+
+static void bench(size_t count)
+{
+    int *last = malloc(count * sizeof(int));
+    char *tables = random_positions(count, last);
+    board_t *boards = malloc(count * sizeof(board_t));
+    long sink = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *t = tables + i * N_GRIDS;
+        board_from_table(&boards[i], t);
+        char win = board_check_win(&boards[i]);
+        int score = board_score(&boards[i], 'O');
+        char result = board_move_result(&boards[i], last[i], t[last[i]]);
+        if (win != legacy_check_win(t) || win != check_win((char *) t) ||
+            win != result ||
+            score != legacy_get_score(t, 'O') ||
+            score != get_score(t, 'O') ||
+            board_score(&boards[i], 'X') != legacy_get_score(t, 'X')) {
+            fprintf(stderr, "position %zu evaluated differently\n", i);
+            draw_board(t);
+            exit(1);
+        }
+    }
+
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+        sink += board_check_win(&boards[i]);
+        sink += board_score(&boards[i], 'O') + board_score(&boards[i], 'X');
+    }
+    report("bitboard:", count, now() - start);
+
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        sink += board_move_result(&boards[i], last[i],
+                                  tables[i * N_GRIDS + last[i]]);
+    }
+    report("last move:", count, now() - start);
+
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        char *t = tables + i * N_GRIDS;
+        sink += check_win(t);
+        sink += get_score(t, 'O') + get_score(t, 'X');
+    }
+    report("char-array adapter:", count, now() - start);
+
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        const char *t = tables + i * N_GRIDS;
+        sink += legacy_check_win(t);
+        sink += legacy_get_score(t, 'O') + legacy_get_score(t, 'X');
+    }
+    report("grid scan:", count, now() - start);
+
+    /* Keep the work from being optimized away */
+    if (sink == 0)
+        printf("(%ld)\n", sink);
+    free(boards);
+    free(tables);
+    free(last);
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-n N] [-s SEED]\n", cmd);
+    printf("\t-h\tPrint this information\n");
+    printf("\t-n N\tMillions of positions to evaluate (default 1)\n");
+    printf("\t-s SEED\tSeed for generating positions\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long millions = 1;
+    int c;
+    while ((c = getopt(argc, argv, "hn:s:")) != -1) {
+        switch (c) {
+        case 'n':
+            millions = atol(optarg);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    const game_t *variant;
+    for (int i = 0; (variant = game_variant(i)); i++) {
+        game_select(variant->board_size, variant->goal);
+        printf("%dx%d board, %d in a row:\n", BOARD_SIZE, BOARD_SIZE, GOAL);
+        bench((millions > 0 ? millions : 1) * 1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+/* Selection benchmark for the UCT scoring of MCTS.
+ *
+ *   uct_bench [-n N] [-s SEED]    pick the child to explore N million times
+ *
+ * Nodes with random visit counts and scores are scanned for their best
+ * child by agents/uct.h and by the fixed-point code agents/mcts.c had before,
+ * and the share of nodes on which the two pick the same child is reported.
+ */
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "agents/mcts.h"
+#include "agents/uct.h"
+
+#define N_NODES 4096
+#define N_CHILDREN 16
+
+typedef struct {
+    uint32_t n_visits;
+    uint32_t child_visits[N_CHILDREN];
+    double child_scores[N_CHILDREN];
+} node_t;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+    /* xorshift64 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The fixed-point scoring agents/mcts.c had before */
+#define SHIFT_AMOUNT 16
+#define FIX_POINT_BIAS (1 << SHIFT_AMOUNT)
+
+static __uint64_t do_log(__uint64_t x)
+{
+    __uint64_t x_plus_1 = x + (1U << SHIFT_AMOUNT);
+    __uint64_t x_minus_1 = x - (1U << SHIFT_AMOUNT);
+    __uint64_t tmp1 = (x_minus_1 << SHIFT_AMOUNT) / x_plus_1;
+    __uint64_t tmp2 = (tmp1 * tmp1) >> SHIFT_AMOUNT;
+    __uint64_t result = 1U << SHIFT_AMOUNT;
+    for (__uint64_t i = 1; i < 10; i++) {
+        __uint64_t term =
+            (tmp2 << SHIFT_AMOUNT) / ((2 * i + 1) << SHIFT_AMOUNT);
+        result += term;
+        tmp2 = (tmp2 * tmp2) >> SHIFT_AMOUNT;
+    }
+
+    result <<= 1;
+    result = (result * tmp1) >> SHIFT_AMOUNT;
+    return result;
+}
+
+static __uint64_t do_sqrt(__uint64_t x)
+{
+    if (x <= 1)
+        return x;
+
+    __uint64_t high = x;
+    __uint64_t low = 0UL;
+    __uint64_t epsilon = 1UL << 10;
+    while ((high - low) > epsilon) {
+        __uint64_t mid = (low + high) / 2;
+        __uint64_t square = (mid * mid) >> 12;
+        if (square == x)
+            return mid;
+        else if (square < x)
+            low = mid;
+        else
+            high = mid;
+    }
+    return (low + high) / 2;
+}
+
+static inline double legacy_uct_score(__uint64_t n_total,
+                                      __uint64_t n_visits,
+                                      double score)
+{
+    if (n_visits == 0)
+        return DBL_MAX;
+    __uint64_t fix_n_total = n_total * FIX_POINT_BIAS;
+    __uint64_t fix_n_visits = n_visits * FIX_POINT_BIAS;
+    __uint64_t fix_score = score * FIX_POINT_BIAS;
+    __uint64_t win = (fix_score * FIX_POINT_BIAS) / fix_n_visits;
+    __uint64_t tmpright1 =
+        (do_log(fix_n_total) * FIX_POINT_BIAS) / fix_n_visits;
+    __uint64_t tmpright2 = do_sqrt(tmpright1);
+    __uint64_t tmpleft = do_log(EXPLORATION_FACTOR * FIX_POINT_BIAS);
+    __uint64_t deep = (tmpright2 * tmpleft) / FIX_POINT_BIAS;
+    win += deep;
+    return (double) win / FIX_POINT_BIAS;
+}
+
+static int legacy_select(const node_t *node)
+{
+    int best = -1;
+    double best_score = -1;
+    for (int i = 0; i < N_CHILDREN; i++) {
+        double score = legacy_uct_score(node->n_visits, node->child_visits[i],
+                                        node->child_scores[i]);
+        if (score > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int uct_select(const node_t *node)
+{
+    double exploration = uct_exploration(node->n_visits);
+    double best_score = -1;
+    int best = -1;
+    for (int i = 0; i < N_CHILDREN; i++) {
+        double score = uct_score(exploration, node->child_visits[i],
+                                 node->child_scores[i]);
+        bool better = score > best_score;
+        best = better ? i : best;
+        best_score = better ? score : best_score;
+    }
+    return best;
+}
+
+/* Visits spread as in a search: most nodes seen a few times, some often */
+static void random_nodes(node_t *nodes)
+{
+    for (int n = 0; n < N_NODES; n++) {
+        node_t *node = &nodes[n];
+        uint32_t scale = 1U << (rng() % 18);
+        node->n_visits = 1;
+        for (int i = 0; i < N_CHILDREN; i++) {
+            uint32_t visits = 1 + rng() % scale;
+            node->child_visits[i] = visits;
+            node->child_scores[i] = (double) (rng() % (2 * visits + 1)) / 2;
+            node->n_visits += visits;
+        }
+    }
+}
+
+static void report(const char *what, size_t count, double elapsed)
+{
+    printf("%-12s %zu selections in %.3f sec: %.2f M selections/s\n", what,
+           count, elapsed, count / 1e6 / elapsed);
+}
+
+static void bench(size_t count)
+{
+    node_t *nodes = malloc(N_NODES * sizeof(node_t));
+    random_nodes(nodes);
+    uct_init();
+
+    size_t same = 0;
+    for (int n = 0; n < N_NODES; n++)
+        same += legacy_select(&nodes[n]) == uct_select(&nodes[n]);
+
+    long sink = 0;
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+        sink += uct_select(&nodes[i % N_NODES]);
+    report("tables:", count, now() - start);
+
+    start = now();
+    for (size_t i = 0; i < count; i++)
+        sink += legacy_select(&nodes[i % N_NODES]);
+    report("fixed point:", count, now() - start);
+
+    printf("same child picked on %.1f%% of the nodes\n",
+           100.0 * same / N_NODES);
+    /* Keep the work from being optimized away */
+    if (sink == 0)
+        printf("(%ld)\n", sink);
+    free(nodes);
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-n N] [-s SEED]\n", cmd);
+    printf("\t-h\tPrint this information\n");
+    printf("\t-n N\tMillions of selections to make (default 1)\n");
+    printf("\t-s SEED\tSeed for generating nodes\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long millions = 1;
+    int c;
+    while ((c = getopt(argc, argv, "hn:s:")) != -1) {
+        switch (c) {
+        case 'n':
+            millions = atol(optarg);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    bench((millions > 0 ? millions : 1) * 1000000);
+    return 0;
+}
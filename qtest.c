@@ -20,6 +20,7 @@
 #include <time.h>
 #endif
 
+#include "dudect/complexity.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
@@ -44,6 +45,7 @@ extern int show_entropy;
 #else
 #include "agents/negamax.h"
 #endif
+#include "agents/util.h"
 static enum game_mode play_mode = PVE;
 
 /* What character limit will be used for displaying strings? */
@@ -68,6 +70,7 @@ typedef int
 
 void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp);
 
+#include "binlog.h"
 #include "console.h"
 #include "report.h"
 
@@ -109,12 +112,16 @@ typedef enum {
 } position_t;
 
 /*function for ttt*/
-static int move_record[N_GRIDS];
+static int move_record[MAX_GRIDS];
 static int move_count = 0;
+static move_stats_t mcts_stats = {.name = "MCTS"};
+static move_stats_t negamax_stats = {.name = "negamax"};
 
+/* Note a move played, by either side; MCTS carries its tree over to it */
 static void record_move(int move)
 {
     move_record[move_count++] = move;
+    mcts_play(move);
 }
 
 static void print_moves()
@@ -630,8 +637,38 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Check in simulation mode that operation op scales no worse than expected
+ * with the size of the queue
+ */
+static bool simulate_complexity(int op,
+                                complexity_t expected,
+                                int argc,
+                                char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+
+    complexity_t found;
+    if (!complexity_check(op, expected, &found)) {
+        report(1, "ERROR: Probably %s, expected %s", complexity_name(found),
+               complexity_name(expected));
+        return false;
+    }
+    if (found > expected)
+        report(1, "Probably %s, too close to %s to tell apart",
+               complexity_name(found), complexity_name(expected));
+    else
+        report(1, "Probably no worse than %s", complexity_name(expected));
+    return true;
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_complexity(SCALE(reverse), COMPLEXITY_N, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -653,6 +690,9 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_complexity(SCALE(size), COMPLEXITY_N, argc, argv);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -701,6 +741,10 @@ static bool do_size(int argc, char *argv[])
 
 bool do_sort(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_complexity(SCALE(sort), COMPLEXITY_N_LOG_N, argc,
+                                   argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -751,6 +795,10 @@ bool do_sort(int argc, char *argv[])
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_complexity(SCALE(delete_mid), COMPLEXITY_N, argc,
+                                   argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -1229,23 +1277,50 @@ static bool do_coro_ttt(int argc, char *argv[])
     return 0;
 }
 
+/* List the board sizes and goals ttt can be played with */
+static void report_variants(void)
+{
+    const game_t *variant;
+    for (int i = 0; (variant = game_variant(i)); i++)
+        report_noreturn(1, "%s%dx%d/%d", i ? ", " : "Try one of ",
+                        variant->board_size, variant->board_size,
+                        variant->goal);
+    report(1, "");
+}
+
 static bool do_ttt(int argc, char *argv[])
 {
-    if (argc < 2) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 2 && argc != 4) {
+        report(1, "%s takes PVE or EVE, then optionally board size and goal",
+               argv[0]);
         return false;
-    } else if (argc == 2) {
-        if (!strcmp(argv[1], "EVE")) {
-            play_mode = EVE;
-        } else if (!strcmp(argv[1], "PVE")) {
-            play_mode = PVE;
-        } else {
-            report(1, "%s wrong arguments need PVE or EVE", argv[0]);
+    }
+    if (!strcmp(argv[1], "EVE")) {
+        play_mode = EVE;
+    } else if (!strcmp(argv[1], "PVE")) {
+        /* The moves are read from the terminal */
+        if (!console_only("ttt PVE"))
+            return false;
+        play_mode = PVE;
+    } else {
+        report(1, "%s wrong arguments need PVE or EVE", argv[0]);
+        return false;
+    }
+    if (argc == 4) {
+        int size, goal;
+        if (!get_int(argv[2], &size) || !get_int(argv[3], &goal)) {
+            report(1, "%s board size and goal must be integers", argv[0]);
+            return false;
+        }
+        if (!game_select(size, goal)) {
+            report(1, "No engine for %dx%d boards won by %d in a row", size,
+                   size, goal);
+            report_variants();
             return false;
         }
     }
     srand(time(NULL));
-    char table[N_GRIDS];
+    char table[MAX_GRIDS];
     memset(table, ' ', N_GRIDS);
     char turn = 'X';
     char ai = 'O';
@@ -1268,7 +1343,9 @@ static bool do_ttt(int argc, char *argv[])
         }
 
         if (turn == ai) {
-            int move = mcts(table, ai);
+            uint64_t start = now_usec();
+            int move = mcts(table, ai, move_budget);
+            move_stats_add(&mcts_stats, now_usec() - start);
             if (move != -1) {
                 table[move] = ai;
                 record_move(move);
@@ -1276,7 +1353,9 @@ static bool do_ttt(int argc, char *argv[])
 
         } else {
             if (play_mode == EVE) {
-                int move = negamax_predict(table, ai2).move;
+                uint64_t start = now_usec();
+                int move = negamax_predict(table, ai2, move_budget).move;
+                move_stats_add(&negamax_stats, now_usec() - start);
                 if (move != -1) {
                     table[move] = ai2;
                     record_move(move);
@@ -1297,6 +1376,8 @@ static bool do_ttt(int argc, char *argv[])
         turn = turn == 'X' ? 'O' : 'X';
     }
     print_moves();
+    move_stats_report(&mcts_stats);
+    move_stats_report(&negamax_stats);
     move_count = 0;
     return 0;
 }
@@ -1348,22 +1429,42 @@ static void console_init()
     ADD_COMMAND(ttt,
                 "type ttt + PVE to play tic tac toe with computer or type ttt "
                 "+ EVE to play tic tac toe between two computer",
-                "");
+                "PVE|EVE [size goal]");
     ADD_COMMAND(coro_ttt, "play tic tac tao between two computer use coroutine",
                 "");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("memlimit", &alloc_limit,
+              "Most bytes the queues may allocate (0: no limit)", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("counter", &dudect_counter,
+              "Counter of constant time tests: 0 TSC, 1 cycles, 2 "
+              "instructions",
+              NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("budget", &move_budget,
+              "Microseconds the ttt agents may take per move (0: fixed work)",
+              NULL);
+    add_param("mcts_threads", &mcts_threads, "Threads searching MCTS moves",
+              NULL);
+    add_param("mcts_tree", &mcts_tree_parallel,
+              "Have MCTS threads share one tree, else merge theirs", NULL);
+    add_param("mcts_seed", &mcts_seed,
+              "Seed of the MCTS playouts, to replay a game (0: random)", NULL);
 }
 
 /* Signal handlers */
 static void sigsegv_handler(int sig)
 {
+    /* Output is buffered.  Save whatever the trace printed so far: this only
+     * writes out what report.c holds, which is safe here as we never return
+     * to the code interrupted.
+     */
+    report_flush();
     /* Avoid possible non-reentrant signal function be used in signal handler */
     assert(write(1,
                  "Segmentation fault occurred.  You dereferenced a NULL or "
@@ -1380,12 +1481,33 @@ static void sigalrm_handler(int sig)
         "code is too inefficient");
 }
 
+static void sigterm_handler(int sig)
+{
+    /* Drain buffered output, with write(2) alone, then terminate the way the
+     * signal intended
+     */
+    report_flush();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Sample queue size and allocated blocks for the binary event log */
+static void q_probe(int *qsize, long *blocks)
+{
+    if (current)
+        *qsize = current->size;
+    *blocks = allocation_check();
+}
+
 static void q_init()
 {
     fail_count = 0;
     INIT_LIST_HEAD(&chain.head);
     signal(SIGSEGV, sigsegv_handler);
     signal(SIGALRM, sigalrm_handler);
+    signal(SIGINT, sigterm_handler);
+    signal(SIGTERM, sigterm_handler);
+    binlog_set_probe(q_probe);
 }
 
 static bool q_quit(int argc, char *argv[])
@@ -1406,6 +1528,13 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
+    /* Web workers carry on with the next session, even if some queue
+     * could not be freed: what is left of it is reported below, not
+     * handed on.
+     */
+    INIT_LIST_HEAD(&chain.head);
+    chain.size = 0;
+    current = NULL;
     set_cautious_mode(true);
 
     size_t bcnt = allocation_check();
@@ -1418,6 +1547,13 @@ static bool q_quit(int argc, char *argv[])
     return true;
 }
 
+/* Release the search trees the ttt agents keep between moves */
+static bool ttt_quit(int argc, char *argv[])
+{
+    mcts_free();
+    return true;
+}
+
 static void usage(char *cmd)
 {
     printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
@@ -1552,6 +1688,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    add_quit_helper(ttt_quit);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
@@ -1,3 +1,7 @@
+/* fopencookie() */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -10,7 +14,6 @@
 #include <unistd.h>
 
 #include "report.h"
-#include "web.h"
 
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
 
@@ -18,11 +21,111 @@ static FILE *errfile = NULL;
 static FILE *verbfile = NULL;
 static FILE *logfile = NULL;
 
+/* Output waiting to be written to a file descriptor.  stdout and the log
+ * file are unbuffered stdio streams writing here instead of to buffers of
+ * their own, so that what is pending can be pushed out with write(2) alone,
+ * which is safe in a signal handler.
+ */
+#define OUT_BUFSIZE (64 * 1024)
+
+typedef struct {
+    int fd;
+    bool lines; /* Write out each complete line */
+    size_t len;
+    char data[OUT_BUFSIZE];
+} out_t;
+
+/* Lines go out as they are completed, in order with what other processes,
+ * e.g. web workers, write to the same terminal, pipe or file
+ */
+static out_t term_out = {.fd = STDOUT_FILENO, .lines = true};
+static out_t log_out = {.fd = -1};
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+static void out_drain(out_t *out)
+{
+    if (out->fd >= 0)
+        write_all(out->fd, out->data, out->len);
+    out->len = 0;
+}
+
+static void out_write(out_t *out, const char *data, size_t len)
+{
+    if (out->len + len > sizeof(out->data)) {
+        out_drain(out);
+        if (len > sizeof(out->data)) {
+            write_all(out->fd, data, len);
+            return;
+        }
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    if (out->lines && memchr(data, '\n', len))
+        out_drain(out);
+}
+
+#if defined(__APPLE__)
+static int out_stream_write(void *cookie, const char *data, int len)
+#else
+static ssize_t out_stream_write(void *cookie, const char *data, size_t len)
+#endif
+{
+    out_write(cookie, data, len);
+    return len;
+}
+
+static int out_stream_close(void *cookie)
+{
+    out_t *out = cookie;
+    out_drain(out);
+    int ret = out->fd >= 0 ? close(out->fd) : 0;
+    out->fd = -1;
+    return ret;
+}
+
+/* Unbuffered stream writing to out */
+static FILE *out_stream(out_t *out)
+{
+#if defined(__APPLE__)
+    FILE *f = funopen(out, NULL, out_stream_write, NULL, out_stream_close);
+#else
+    FILE *f = fopencookie(out, "w",
+                          (cookie_io_functions_t){
+                              .write = out_stream_write,
+                              .close = out_stream_close,
+                          });
+#endif
+    if (f)
+        setvbuf(f, NULL, _IONBF, 0);
+    return f;
+}
+
 int verblevel = 0;
-static void init_files(FILE *efile, FILE *vfile)
+
+/* Send stdout, printf() and the like included, through term_out, so that
+ * output from elsewhere stays in order with what is reported here
+ */
+static void init_files(void)
 {
-    errfile = efile;
-    verbfile = vfile;
+    FILE *f = out_stream(&term_out);
+    if (f) {
+        fflush(stdout);
+        stdout = f;
+    }
+    errfile = verbfile = stdout;
+    atexit(report_flush);
 }
 
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
@@ -33,8 +136,10 @@ static volatile int ret = 0;
 static void default_fatal_fun()
 {
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
-    if (logfile)
+    if (logfile) {
         fputs(fail_buf, logfile);
+        fflush(logfile);
+    }
 }
 
 /* Optional function to call when fatal error encountered */
@@ -42,13 +147,28 @@ static void (*fatal_fun)() = default_fatal_fun;
 
 void set_verblevel(int level)
 {
+    /* Take stdout over before anything is printed to it the plain way */
+    if (!verbfile)
+        init_files();
     verblevel = level;
 }
 
 bool set_logfile(const char *file_name)
 {
-    logfile = fopen(file_name, "w");
-    return logfile != NULL;
+    if (logfile) {
+        fclose(logfile);
+        logfile = NULL;
+    }
+    log_out.fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (log_out.fd < 0)
+        return false;
+    log_out.len = 0;
+    logfile = out_stream(&log_out);
+    if (!logfile) {
+        close(log_out.fd);
+        log_out.fd = -1;
+    }
+    return logfile;
 }
 
 void report_event(message_t msg, char *fmt, ...)
@@ -69,13 +189,12 @@ void report_event(message_t msg, char *fmt, ...)
         return;
 
     if (!errfile)
-        init_files(stdout, stdout);
+        init_files();
 
     va_start(ap, fmt);
     fprintf(errfile, "%s: ", msg_name);
     vfprintf(errfile, fmt, ap);
     fprintf(errfile, "\n");
-    fflush(errfile);
     va_end(ap);
 
     if (logfile) {
@@ -83,79 +202,129 @@ void report_event(message_t msg, char *fmt, ...)
         fprintf(logfile, "Error: ");
         vfprintf(logfile, fmt, ap);
         fprintf(logfile, "\n");
-        fflush(logfile);
         va_end(ap);
-        fclose(logfile);
     }
 
+    /* Events are rare: write them out right away */
+    report_flush();
+
     if (fatal) {
         if (fatal_fun)
             fatal_fun();
+        if (logfile)
+            fclose(logfile);
         exit(1);
     }
 }
 
 #define BUF_SIZE 4096
-extern int web_connfd;
+
+static report_sink_t *sink = NULL;
+
+void report_set_sink(report_sink_t *s)
+{
+    sink = s;
+}
+
+/* Make room in the sink for n more bytes and a terminating null */
+static bool sink_reserve(size_t n)
+{
+    if (sink->len + n < sink->size)
+        return true;
+    size_t size = sink->size ? sink->size : BUF_SIZE;
+    while (sink->len + n >= size)
+        size *= 2;
+    char *data = realloc(sink->data, size);
+    if (!data)
+        return false;
+    sink->data = data;
+    sink->size = size;
+    return true;
+}
+
+/* Format the message once and hand the same text to every sink.  Output is
+ * left in term_out and log_out: they are drained when full, line by line on
+ * a terminal, at exit, on fatal errors and through report_flush(), rather
+ * than with one write system call per line.
+ */
+static void report_vprint(char *buffer, bool newline, char *fmt, va_list ap)
+{
+    va_list aq;
+    va_copy(aq, ap);
+    int len = vsnprintf(buffer, BUF_SIZE - 1, fmt, aq);
+    va_end(aq);
+
+    if (len < 0) {
+        buffer[0] = '\0';
+        len = 0;
+    }
+
+    /* Output that cannot be stored is lost to the sink only */
+    if (sink && sink_reserve(len + 1)) {
+        if (len >= BUF_SIZE - 1) {
+            va_copy(aq, ap);
+            vsnprintf(sink->data + sink->len, len + 1, fmt, aq);
+            va_end(aq);
+        } else {
+            memcpy(sink->data + sink->len, buffer, len);
+        }
+        sink->len += len;
+        if (newline)
+            sink->data[sink->len++] = '\n';
+    }
+
+    if (len >= BUF_SIZE - 1) {
+        /* Too long for the line buffer.  Let stdio format it directly */
+        va_copy(aq, ap);
+        vfprintf(verbfile, fmt, aq);
+        va_end(aq);
+        if (logfile)
+            vfprintf(logfile, fmt, ap);
+    } else {
+        fputs(buffer, verbfile);
+        if (logfile)
+            fputs(buffer, logfile);
+    }
+
+    if (newline) {
+        fputc('\n', verbfile);
+        if (logfile)
+            fputc('\n', logfile);
+    }
+}
+
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
-        init_files(stdout, stdout);
+        init_files();
 
-    char buffer[BUF_SIZE];
     if (level <= verblevel) {
+        char buffer[BUF_SIZE];
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
-        va_end(ap);
-
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fprintf(logfile, "\n");
-            fflush(logfile);
-            va_end(ap);
-        }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
+        report_vprint(buffer, true, fmt, ap);
         va_end(ap);
     }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
-    }
 }
 
 void report_noreturn(int level, char *fmt, ...)
 {
     if (!verbfile)
-        init_files(stdout, stdout);
+        init_files();
 
-    char buffer[BUF_SIZE];
     if (level <= verblevel) {
+        char buffer[BUF_SIZE];
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
-        va_end(ap);
-
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fflush(logfile);
-            va_end(ap);
-        }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
+        report_vprint(buffer, false, fmt, ap);
         va_end(ap);
     }
+}
 
-    if (web_connfd)
-        web_send(web_connfd, buffer);
+void report_flush(void)
+{
+    out_drain(&term_out);
+    out_drain(&log_out);
 }
 
 /* Functions denoting failures */
@@ -164,6 +333,7 @@ void report_noreturn(int level, char *fmt, ...)
 static void fail_fun(const char *format, const char *msg)
 {
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
+    report_flush();
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
     /* Use write to avoid any buffering issues */
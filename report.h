@@ -26,6 +26,26 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Push out any buffered output to the terminal and log file.  Only write(2)
+ * is used, so this may be called from a signal handler that then ends the
+ * process.
+ */
+void report_flush(void);
+
+/* Growable buffer collecting a copy of the reported output, e.g. the response
+ * to a web request, so that it can be sent in one piece once complete.
+ */
+typedef struct {
+    char *data;
+    size_t len;  /* Bytes of output held */
+    size_t size; /* Bytes allocated */
+} report_sink_t;
+
+/* Append the output of report() and report_noreturn() to sink as well, until
+ * called with NULL.  The owner of the sink empties and frees it.
+ */
+void report_set_sink(report_sink_t *sink);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, const char *fun_name);
 
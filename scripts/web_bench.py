@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+# Load generator for the web interface of qtest.
+#
+# Start qtest, enter 'web [port]' at its prompt, then run for example
+#   scripts/web_bench.py -c 16 -n 20000 /it/RAND
+# to send 20000 commands over 16 concurrent clients and report the request
+# rate together with latency percentiles.  Add -k to keep connections open
+# and -P 32 to pipeline 32 requests at a time on each of them.
+
+import argparse
+import socket
+import threading
+import time
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Benchmark the qtest web command channel")
+    parser.add_argument("path", nargs="?", default="/size",
+                        help="request path, i.e. command (default: /size)")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("-p", "--port", type=int, default=9999)
+    parser.add_argument("-c", "--clients", type=int, default=8,
+                        help="number of concurrent clients")
+    parser.add_argument("-n", "--requests", type=int, default=10000,
+                        help="total number of requests")
+    parser.add_argument("-k", "--keep-alive", action="store_true",
+                        help="reuse one connection per client")
+    parser.add_argument("-P", "--pipeline", type=int, default=1,
+                        help="requests in flight per keep-alive connection")
+    return parser.parse_args()
+
+
+class Reader:
+    def __init__(self, sock):
+        self.sock = sock
+        self.data = b""
+
+    def until(self, delim):
+        """Return data up to and excluding delim, or None on EOF."""
+        while delim not in self.data:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                return None
+            self.data += chunk
+        line, _, self.data = self.data.partition(delim)
+        return line
+
+    def exactly(self, n):
+        while len(self.data) < n:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                return None
+            self.data += chunk
+        out, self.data = self.data[:n], self.data[n:]
+        return out
+
+
+def read_chunked(reader):
+    while True:
+        size = reader.until(b"\r\n")
+        if size is None:
+            return False
+        size = int(size.split(b";")[0], 16)
+        if reader.exactly(size + 2) is None:
+            return False
+        if size == 0:
+            return True
+
+
+def read_response(sock, pending):
+    """Read one response; return (complete, connection_closed, rest)."""
+    reader = Reader(sock)
+    reader.data = pending
+    head = reader.until(b"\r\n\r\n")
+    if head is None:
+        return reader.data != b"", True, b""
+    headers = head.decode("latin-1").lower()
+    closed = "connection: close" in headers
+    if "transfer-encoding: chunked" in headers:
+        ok = read_chunked(reader)
+        return ok, closed or not ok, reader.data
+    body = reader.data
+    length = None
+    for line in headers.split("\r\n")[1:]:
+        name, _, value = line.partition(":")
+        if name.strip() == "content-length":
+            length = int(value)
+    if length is None:
+        # Delimited by closing the connection
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                return True, True, b""
+    while len(body) < length:
+        chunk = sock.recv(65536)
+        if not chunk:
+            return False, True, b""
+        body += chunk
+    return True, closed, body[length:]
+
+
+def client(args, count, latencies, errors):
+    request = ("GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n" %
+               (args.path, args.host,
+                "" if args.keep_alive else "Connection: close\r\n")).encode()
+    depth = args.pipeline if args.keep_alive else 1
+    sock = None
+    pending = b""
+    while count > 0:
+        batch = min(depth, count)
+        count -= batch
+        start = time.perf_counter()
+        try:
+            if sock is None:
+                sock = socket.create_connection((args.host, args.port))
+                pending = b""
+            sock.sendall(request * batch)
+            for i in range(batch):
+                ok, closed, pending = read_response(sock, pending)
+                latencies.append(time.perf_counter() - start)
+                if not ok:
+                    errors.append(1)
+                if closed:
+                    # Requests still in flight are lost
+                    errors.extend([1] * (batch - 1 - i))
+                    break
+        except OSError:
+            latencies.append(time.perf_counter() - start)
+            errors.append(1)
+            closed = True
+        if closed or not args.keep_alive:
+            if sock is not None:
+                sock.close()
+            sock = None
+    if sock is not None:
+        sock.close()
+
+
+def percentile(sorted_values, q):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(q * len(sorted_values)))
+    return sorted_values[index]
+
+
+def main():
+    args = parse_args()
+    latencies = []
+    errors = []
+    per_client = [args.requests // args.clients] * args.clients
+    for i in range(args.requests % args.clients):
+        per_client[i] += 1
+
+    threads = [
+        threading.Thread(target=client, args=(args, n, latencies, errors))
+        for n in per_client
+    ]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    latencies.sort()
+    print("%d requests, %d clients, %d errors in %.3f sec" %
+          (len(latencies), args.clients, len(errors), elapsed))
+    print("%.1f requests/sec" % (len(latencies) / elapsed))
+    print("latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f" %
+          tuple(1000 * percentile(latencies, q)
+                for q in (0.50, 0.90, 0.99, 1.0)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+
+# Check that the web interface of qtest delivers a response larger than the
+# socket buffers in full before closing the connection, and that its workers
+# start each connection afresh.
+#
+#   scripts/web_test.py [-p PORT] [QTEST]
+#
+# Starts QTEST (default ./qtest) on a pseudo terminal, as the web server
+# only runs alongside the interactive console, and tries both the epoll and
+# the io_uring event loops.  The client asks for a queue of long strings to
+# be shown many times, with "Connection: close", while keeping its receive
+# buffer small and reading late, so that the server has to send the response
+# in several parts.
+#
+# Then a single worker serves several connections in turn: a repeat block
+# left open or errors made by one must not affect the next.  Last, clients
+# of the console process itself must not record into one another's blocks.
+
+import argparse
+import fcntl
+import os
+import pty
+import select
+import signal
+import socket
+import struct
+import sys
+import termios
+import threading
+import time
+
+# Elements of the queue, few enough for show to print them all, their
+# length, and how many times the queue is shown in the response.  Sockets on
+# loopback start with send buffers of a few megabytes.
+ELEMENTS = 30
+LENGTH = 1000
+REPEATS = 300
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Test large responses from the qtest web interface")
+    parser.add_argument("qtest", nargs="?", default="./qtest")
+    parser.add_argument("-p", "--port", type=int, default=9871)
+    return parser.parse_args()
+
+
+def drain(fd, until=None, timeout=0.1):
+    """Read what qtest prints, answering its cursor position queries, until
+    it prints until or nothing comes for timeout seconds.  Return whether it
+    printed until."""
+    out = b""
+    while select.select([fd], [], [], timeout)[0]:
+        try:
+            chunk = os.read(fd, 65536)
+        except OSError:
+            break
+        if not chunk:
+            break
+        for _ in range(chunk.count(b"\x1b[6n")):
+            os.write(fd, b"\x1b[1;1R")
+        out += chunk
+        if until and until in out:
+            return True
+    return False
+
+
+def command(fd, line):
+    """Type line at the prompt and wait for the next one."""
+    os.write(fd, line + b"\r")
+    return drain(fd, b"cmd> ", 5)
+
+
+def start(qtest, port, uring, workers=0):
+    pid, fd = pty.fork()
+    if pid == 0:
+        # linenoise needs to know the width of the terminal
+        fcntl.ioctl(0, termios.TIOCSWINSZ, struct.pack("HHHH", 24, 80, 0, 0))
+        os.execv(qtest, [qtest])
+    if not (drain(fd, b"cmd> ", 5) and
+            command(fd, b"option uring %d" % uring) and
+            command(fd, b"web %d %d" % (port, workers))):
+        os.kill(pid, signal.SIGKILL)
+        sys.exit("qtest does not serve web requests on port %d" % port)
+    return pid, fd
+
+
+def request(port, path, rcvbuf=0):
+    """Return the whole response to GET path, read up to EOF."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    if rcvbuf:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+    sock.connect(("127.0.0.1", port))
+    sock.sendall(b"GET %s HTTP/1.1\r\nHost: localhost\r\n"
+                 b"Connection: close\r\n\r\n" % path.encode())
+    if rcvbuf:
+        # Let the server run into the full buffers
+        time.sleep(0.5)
+    data = b""
+    sock.settimeout(10)
+    while True:
+        chunk = sock.recv(rcvbuf or 65536)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    return data
+
+
+class Session:
+    """One keep-alive connection, sending a request at a time"""
+
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port), timeout=5)
+        self.data = b""
+
+    def get(self, path):
+        """Return the body of the response to GET path, None on failure"""
+        try:
+            self.sock.sendall(b"GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                              % path.encode())
+            while b"\r\n\r\n" not in self.data:
+                chunk = self.sock.recv(65536)
+                if not chunk:
+                    return None
+                self.data += chunk
+            head, _, self.data = self.data.partition(b"\r\n\r\n")
+            length = 0
+            for line in head.split(b"\r\n")[1:]:
+                name, _, value = line.partition(b":")
+                if name.strip().lower() == b"content-length":
+                    length = int(value)
+            while len(self.data) < length:
+                chunk = self.sock.recv(65536)
+                if not chunk:
+                    return None
+                self.data += chunk
+        except (OSError, ValueError):
+            return None
+        body, self.data = self.data[:length], self.data[length:]
+        return body
+
+    def close(self):
+        self.sock.close()
+
+
+def session(port, paths):
+    """Send GET requests for paths over one connection and return the
+    bodies of the responses, up to the first that failed."""
+    conn = Session(port)
+    bodies = []
+    for path in paths:
+        body = conn.get(path)
+        if body is None:
+            break
+        bodies.append(body)
+    conn.close()
+    return bodies
+
+
+def complete(response):
+    """Whether the body is as long as Content-Length says."""
+    head, sep, body = response.partition(b"\r\n\r\n")
+    if not sep:
+        return False
+    for line in head.split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            return int(value) == len(body)
+    return False
+
+
+def run(qtest, port, uring):
+    pid, fd = start(qtest, port, uring)
+    # qtest echoes the commands and their output, and would block on a full
+    # terminal
+    threading.Thread(target=drain, args=(fd, None, 60), daemon=True).start()
+    try:
+        request(port, "/new")
+        request(port, "/ih/%s/%d" % ("x" * LENGTH, ELEMENTS))
+        response = request(port, "/repeat/%d/show" % REPEATS, rcvbuf=4096)
+    finally:
+        os.kill(pid, signal.SIGKILL)
+        os.waitpid(pid, 0)
+    ok = len(response) > REPEATS * ELEMENTS * LENGTH and complete(response)
+    print("%s: %d bytes, %s" % ("io_uring" if uring else "epoll",
+                                len(response),
+                                "complete" if ok else "TRUNCATED"))
+    return ok
+
+
+def run_worker(qtest, port):
+    pid, fd = start(qtest, port, 0, workers=1)
+    threading.Thread(target=drain, args=(fd, None, 60), daemon=True).start()
+    try:
+        # A block opened by one client is not filled by the next
+        session(port, ["/repeat/2"])
+        block = session(port, ["/new", "/ih/a", "/show"])
+        # The error limit, 5 by default, applies to each connection
+        bad = ["/nosuchcommand"] * 4
+        session(port, bad)
+        errors = session(port, bad + ["/new"])
+    finally:
+        os.kill(pid, signal.SIGKILL)
+        os.waitpid(pid, 0)
+    ok = True
+    if len(block) != 3 or b"[a]" not in block[2]:
+        print("worker: commands went into another client's repeat block")
+        ok = False
+    if len(errors) != 5 or b"[]" not in errors[4]:
+        print("worker: errors carried over from another client")
+        ok = False
+    if ok:
+        print("worker: connections are independent")
+    return ok
+
+
+def run_blocks(qtest, port):
+    pid, fd = start(qtest, port, 0)
+    threading.Thread(target=drain, args=(fd, None, 60), daemon=True).start()
+    try:
+        # Commands of other clients run while one records a repeat block
+        first = Session(port)
+        first.get("/new")
+        first.get("/repeat/2")
+        first.get("/it/b")
+        other = session(port, ["/ih/a", "/show"])
+        first.get("/end")
+        first.close()
+        after = session(port, ["/show"])
+    finally:
+        os.kill(pid, signal.SIGKILL)
+        os.waitpid(pid, 0)
+    ok = (len(other) == 2 and b"[a]" in other[1] and len(after) == 1 and
+          b"[a b b]" in after[0])
+    print("blocks: %s" % ("kept to their client" if ok else
+                          "took the commands of another client"))
+    return ok
+
+
+def main():
+    args = parse_args()
+    ok = True
+    for uring in (0, 1):
+        ok = run(args.qtest, args.port + uring, uring) and ok
+    ok = run_worker(args.qtest, args.port + 2) and ok
+    ok = run_blocks(args.qtest, args.port + 3) and ok
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,12 @@
 # Test if time complexity of q_insert_tail, q_insert_head, q_remove_tail, and q_remove_head is constant
+# and if q_size, q_reverse and q_delete_mid are linear and q_sort is linearithmic
 option simulation 1
 it
 ih
 rh
 rt
+size
+reverse
+sort
+dm
 option simulation 0
@@ -0,0 +1,7 @@
+# Record a session in a binary log and quit while the log is still open
+binlog /tmp/qtest.binlog
+new
+ih a
+it b
+rh a
+quit
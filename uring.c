@@ -0,0 +1,400 @@
+/* Minimal io_uring support, without depending on liburing.
+ *
+ * The ring is mapped as described in io_uring_setup(2).  Submission queue
+ * entries are published as soon as they are filled in, but only handed to
+ * the kernel, all at once, when waiting for completions.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+/* Multishot accept and provided buffer rings arrived with Linux 5.19 */
+#if defined(IORING_ACCEPT_MULTISHOT) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+/* Group of the provided buffers */
+#define BGID 0
+
+static struct {
+    int fd;
+    /* Submission queue */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned to_submit; /* Published, not yet handed to the kernel */
+    struct io_uring_sqe *sqes;
+    /* Completion queue */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mappings */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    /* Provided buffers */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    unsigned short br_tail;
+    unsigned nbufs;
+    size_t bufsize;
+    char *bufs;
+} ring = {.fd = -1};
+
+static int sys_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+static void *ring_ptr(void *base, unsigned offset)
+{
+    return (char *) base + offset;
+}
+
+bool uring_init(unsigned entries, unsigned nbufs, size_t bufsize)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring.fd < 0)
+        return false;
+
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size)
+            ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED)
+        goto fail_ring;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring =
+            mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED)
+            goto fail_sq;
+    }
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+        goto fail_cq;
+
+    ring.sq_head = ring_ptr(ring.sq_ring, p.sq_off.head);
+    ring.sq_tail = ring_ptr(ring.sq_ring, p.sq_off.tail);
+    ring.sq_mask = ring_ptr(ring.sq_ring, p.sq_off.ring_mask);
+    ring.sq_array = ring_ptr(ring.sq_ring, p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.to_submit = 0;
+    ring.cq_head = ring_ptr(ring.cq_ring, p.cq_off.head);
+    ring.cq_tail = ring_ptr(ring.cq_ring, p.cq_off.tail);
+    ring.cq_mask = ring_ptr(ring.cq_ring, p.cq_off.ring_mask);
+    ring.cqes = ring_ptr(ring.cq_ring, p.cq_off.cqes);
+
+    /* Buffer ring: nbufs must be a power of 2 */
+    ring.nbufs = nbufs;
+    ring.bufsize = bufsize;
+    ring.br_size = nbufs * sizeof(struct io_uring_buf);
+    ring.br = mmap(NULL, ring.br_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring.br == MAP_FAILED)
+        goto fail_sqes;
+    ring.bufs = malloc(nbufs * bufsize);
+    if (!ring.bufs)
+        goto fail_br;
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (unsigned long) ring.br,
+        .ring_entries = nbufs,
+        .bgid = BGID,
+    };
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0)
+        goto fail_bufs;
+    ring.br_tail = 0;
+    for (unsigned i = 0; i < nbufs; i++)
+        uring_recycle(i);
+    return true;
+
+fail_bufs:
+    free(ring.bufs);
+fail_br:
+    munmap(ring.br, ring.br_size);
+fail_sqes:
+    munmap(ring.sqes, ring.sqes_size);
+fail_cq:
+    if (ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+fail_sq:
+    munmap(ring.sq_ring, ring.sq_ring_size);
+fail_ring:
+    close(ring.fd);
+    ring.fd = -1;
+    return false;
+}
+
+void uring_exit(void)
+{
+    if (ring.fd < 0)
+        return;
+    /* Closing the ring cancels whatever is still in flight */
+    close(ring.fd);
+    ring.fd = -1;
+    free(ring.bufs);
+    munmap(ring.br, ring.br_size);
+    munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    munmap(ring.sq_ring, ring.sq_ring_size);
+}
+
+/* Make room for n more submission queue entries */
+static bool reserve(unsigned n)
+{
+    unsigned tail = *ring.sq_tail;
+    if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) + n >
+        ring.sq_entries) {
+        /* Full: hand over what is there to make room */
+        int k = sys_enter(ring.to_submit, 0, 0);
+        if (k < 0)
+            return false;
+        ring.to_submit -= k;
+        if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) + n >
+            ring.sq_entries)
+            return false;
+    }
+    return true;
+}
+
+/* Next free submission queue entry, cleared */
+static struct io_uring_sqe *get_sqe(void)
+{
+    if (!reserve(1))
+        return NULL;
+    struct io_uring_sqe *sqe = &ring.sqes[*ring.sq_tail & *ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static bool publish(struct io_uring_sqe *sqe, uint64_t user_data)
+{
+    unsigned tail = *ring.sq_tail;
+    unsigned idx = tail & *ring.sq_mask;
+    sqe->user_data = user_data;
+    ring.sq_array[idx] = idx;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    return true;
+}
+
+bool uring_prep_accept_multishot(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    return publish(sqe, user_data);
+}
+
+bool uring_prep_poll(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    return publish(sqe, user_data);
+}
+
+bool uring_prep_recv(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = ring.bufsize;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    return publish(sqe, user_data);
+}
+
+static void prep_sendmsg(struct io_uring_sqe *sqe,
+                         int fd,
+                         const struct msghdr *msg)
+{
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+bool uring_prep_sendmsg(int fd, const struct msghdr *msg, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    prep_sendmsg(sqe, fd, msg);
+    return publish(sqe, user_data);
+}
+
+bool uring_prep_sendmsg_close(int fd,
+                              const struct msghdr *msg,
+                              uint64_t send_data,
+                              uint64_t close_data)
+{
+    /* A link with nothing queued after it would end at whatever comes next,
+     * so both entries are taken before either is published
+     */
+    if (!reserve(2))
+        return false;
+    struct io_uring_sqe *sqe = get_sqe();
+    prep_sendmsg(sqe, fd, msg);
+    /* Only a failed send breaks the link, and a short one counts as failed
+     * only with MSG_WAITALL
+     */
+    sqe->msg_flags |= MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    publish(sqe, send_data);
+    return uring_prep_close(fd, close_data);
+}
+
+bool uring_prep_close(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    return publish(sqe, user_data);
+}
+
+bool uring_prep_cancel(uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = target;
+    return publish(sqe, user_data);
+}
+
+int uring_wait(uring_cqe_t *cqes, int max)
+{
+    unsigned head = *ring.cq_head;
+    bool empty = head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    if (ring.to_submit || empty) {
+        int n = sys_enter(ring.to_submit, empty ? 1 : 0,
+                          IORING_ENTER_GETEVENTS);
+        if (n < 0)
+            return -1;
+        ring.to_submit -= n;
+    }
+
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    for (; head != tail && n < max; head++, n++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        cqes[n].user_data = cqe->user_data;
+        cqes[n].res = cqe->res;
+        cqes[n].bid = (cqe->flags & IORING_CQE_F_BUFFER)
+                          ? (int) (cqe->flags >> IORING_CQE_BUFFER_SHIFT)
+                          : -1;
+        cqes[n].more = cqe->flags & IORING_CQE_F_MORE;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+char *uring_buffer(int bid)
+{
+    return ring.bufs + (size_t) bid * ring.bufsize;
+}
+
+void uring_recycle(int bid)
+{
+    struct io_uring_buf *buf = &ring.br->bufs[ring.br_tail & (ring.nbufs - 1)];
+    buf->addr = (unsigned long) uring_buffer(bid);
+    buf->len = ring.bufsize;
+    buf->bid = bid;
+    ring.br_tail++;
+    __atomic_store_n(&ring.br->tail, ring.br_tail, __ATOMIC_RELEASE);
+}
+
+#else /* !HAVE_IO_URING */
+
+bool uring_init(unsigned entries, unsigned nbufs, size_t bufsize)
+{
+    return false;
+}
+
+void uring_exit(void) {}
+
+bool uring_prep_accept_multishot(int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool uring_prep_poll(int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool uring_prep_recv(int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool uring_prep_sendmsg(int fd,
+                        const struct msghdr *msg,
+                        bool link,
+                        uint64_t user_data)
+{
+    return false;
+}
+
+bool uring_prep_close(int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool uring_prep_cancel(uint64_t target, uint64_t user_data)
+{
+    return false;
+}
+
+int uring_wait(uring_cqe_t *cqes, int max)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+char *uring_buffer(int bid)
+{
+    return NULL;
+}
+
+void uring_recycle(int bid) {}
+
+#endif /* HAVE_IO_URING */
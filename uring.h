@@ -0,0 +1,71 @@
+#ifndef LAB0_URING_H
+#define LAB0_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Minimal io_uring interface for the web server, on top of the raw system
+ * calls.  There is a single ring per process.  Requests are queued by the
+ * uring_prep_*() functions and submitted together by the next uring_wait(),
+ * which also collects their completions.
+ *
+ * Received data lands in a group of provided buffers, registered with the
+ * kernel up front, which must be given back once consumed.
+ */
+
+/* Completion of a request */
+typedef struct {
+    uint64_t user_data; /* As given when the request was queued */
+    int res;            /* Result: as from the system call, or -errno */
+    int bid;            /* Provided buffer holding the data, -1 if none */
+    bool more;          /* Multishot request stays armed */
+} uring_cqe_t;
+
+/* Set up a ring and nbufs provided buffers of bufsize bytes each.  Return
+ * false when io_uring, or a feature used here, is not available.
+ */
+bool uring_init(unsigned entries, unsigned nbufs, size_t bufsize);
+
+/* Tear down the ring.  Pending requests are cancelled */
+void uring_exit(void);
+
+/* Accept connections on fd until further notice */
+bool uring_prep_accept_multishot(int fd, uint64_t user_data);
+
+/* Wait for fd to become readable */
+bool uring_prep_poll(int fd, uint64_t user_data);
+
+/* Receive into a provided buffer */
+bool uring_prep_recv(int fd, uint64_t user_data);
+
+/* Send the iovcnt buffers of msg */
+bool uring_prep_sendmsg(int fd, const struct msghdr *msg, uint64_t user_data);
+
+/* Send msg and close fd once it has gone out in full.  The close completes
+ * with -ECANCELED if the send fails or sends less.  Return false, queueing
+ * neither, when there is no room for both.
+ */
+bool uring_prep_sendmsg_close(int fd,
+                              const struct msghdr *msg,
+                              uint64_t send_data,
+                              uint64_t close_data);
+
+bool uring_prep_close(int fd, uint64_t user_data);
+
+/* Cancel the request queued with user_data target */
+bool uring_prep_cancel(uint64_t target, uint64_t user_data);
+
+/* Submit the queued requests, wait for at least one completion and store
+ * up to max of them in cqes.  Return their number, -1 on error.
+ */
+int uring_wait(uring_cqe_t *cqes, int max);
+
+/* Data of provided buffer bid */
+char *uring_buffer(int bid);
+
+/* Hand provided buffer bid back for receiving */
+void uring_recycle(int bid);
+
+#endif /* LAB0_URING_H */
@@ -4,88 +4,269 @@
 
 #include <arpa/inet.h> /* inet_ntoa */
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#endif
+
+#include "http_parser.h"
+#include "report.h"
+#include "uring.h"
+#include "web.h"
+
 #define LISTENQ 1024 /* second argument to listen() */
 #define MAXLINE 1024 /* max length of a line */
-#define BUFSIZE 1024
+#define BUFSIZE 8192 /* max size of buffered request data per client */
+#define MAX_EVENTS 64
+
+/* io_uring: queue entries, and provided buffers (a power of 2) for receiving */
+#define URING_ENTRIES 256
+#define URING_NBUFS 256
+#define URING_BUFSIZE 4096
+
+/* How long a blocked response may wait for the client to drain (ms) */
+#define SEND_TIMEOUT 1000
+
+/* How long a worker stays with a session that sends nothing (ms) */
+#define IDLE_TIMEOUT 5000
 
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 9999 /* use this port if none given as arg to main() */
 #endif
 
-#if defined(__APPLE__) || defined(__FreeBSD__)
-#define TCP_CORK TCP_NOPUSH
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
 #endif
 
 static int server_fd;
 
-typedef struct {
-    int fd;            /* descriptor for this buf */
-    int count;         /* unread byte in this buf */
-    char *bufptr;      /* next unread byte in this buf */
-    char buf[BUFSIZE]; /* internal buffer */
-} rio_t;
+/* Response queued for sending through io_uring */
+typedef struct __web_out {
+    struct __web_out *next;
+    struct msghdr msg;
+    struct iovec iov[2];
+    bool linked;  /* Close of the connection is linked to it */
+    char *data;   /* Body, taken over from the response sink */
+    size_t size;  /* Bytes allocated for data */
+    char header[128];
+} web_out_t;
+
+/* State of one client connection.  Requests are accumulated in buf until
+ * their header is complete; bytes beyond it belong to the next (pipelined)
+ * requests, which are served in order on the same connection.
+ */
+typedef struct __web_conn {
+    int fd;
+    unsigned long id;        /* Serial number, never reused */
+    bool eof;                /* Peer closed, or the connection failed */
+    bool queued;             /* Holds a complete request, in ready queue */
+    bool keep_alive;         /* Connection stays open after the response */
+    size_t len;              /* Bytes buffered in buf */
+    http_request_t req;      /* First request in buf, once it is queued */
+    struct __web_conn *next; /* Next connection in ready queue */
+    /* With io_uring, received data beyond what fits in buf is held in its
+     * provided buffer.  The connection lives on until all requests referring
+     * to it have completed.
+     */
+    int pending;      /* Requests in flight */
+    bool recv_armed;  /* Receive in flight */
+    bool closing;     /* To be closed once the queued responses are sent */
+    bool close_armed; /* Close in flight */
+    bool closed;      /* Descriptor closed */
+    int held;         /* Provided buffer with data for buf, -1 if none */
+    size_t held_off;  /* Offset of the data held in that buffer */
+    size_t held_len;  /* Bytes held */
+    web_out_t *out;   /* Responses being sent, the first one in flight */
+    char buf[BUFSIZE];
+} web_conn_t;
+
+/* Connections with a complete request, served in arrival order */
+static web_conn_t *ready_head = NULL, *ready_tail = NULL;
+
+/* Connection whose command is being executed */
+static web_conn_t *active = NULL;
+
+/* Output of the command run for the active connection */
+static report_sink_t response;
+
+/* Memory kept for the next response after sending a large one */
+#define RESPONSE_KEEP (1 << 20)
+
+/* Tags telling the listening socket and stdin apart from connections */
+static char stdin_tag, server_tag;
+
+/* Clients are served through io_uring rather than epoll or poll */
+static bool use_uring = false;
+
+/* The user data of an io_uring request tells what it is about: an operation
+ * on a connection, kept in the low bits of its address, or one of the
+ * operations without a connection.
+ */
+enum {
+    URING_RECV,
+    URING_SEND,
+    URING_CLOSE,
+    URING_IGNORE,
+    URING_ACCEPT,
+    URING_STDIN,
+};
+#define URING_OP_MASK 7
+
+/* Stdin is polled through the ring, or cannot be polled at all */
+static bool stdin_armed = false;
+
+/* When sessions are served by a pool: the process supervising the workers,
+ * and (in that process) the workers themselves.
+ */
+static pid_t supervisor = 0;
+static pid_t *workers = NULL;
+static int n_workers = 0;
 
-typedef struct {
-    char filename[512];
-    off_t offset; /* for support Range */
-    size_t end;
-} http_request_t;
+/* Readiness notification: epoll on Linux, poll() elsewhere.  Every watched
+ * descriptor carries a pointer handed back when it becomes readable.
+ */
+#if defined(__linux__)
+static int epoll_fd = -1;
 
-static void rio_readinitb(rio_t *rp, int fd)
+static bool ev_init(void)
 {
-    rp->fd = fd;
-    rp->count = 0;
-    rp->bufptr = rp->buf;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return epoll_fd >= 0;
 }
 
-/* This is a wrapper for the Unix read() function that transfers min(n, count)
- * bytes from an internal buffer to a user buffer, where n is the number of
- * bytes requested by the user and count is the number of unread bytes in the
- * internal buffer. On entry, rio_read() refills the internal buffer via a call
- * to read() if the internal buffer is empty.
- */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
-{
-    int cnt;
-    while (rp->count <= 0) { /* refill if buf is empty */
-        rp->count = read(rp->fd, rp->buf, sizeof(rp->buf));
-        if (rp->count < 0) {
-            if (errno != EINTR) /* interrupted by sig handler return */
-                return -1;
-        } else if (rp->count == 0) { /* EOF */
-            return 0;
-        } else
-            rp->bufptr = rp->buf; /* reset buffer ptr */
+static bool ev_add(int fd, void *ptr)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = ptr};
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void ev_del(int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void ev_close(void)
+{
+    close(epoll_fd);
+    epoll_fd = -1;
+}
+
+static int ev_wait(void **ready, int max)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, max, -1);
+    for (int i = 0; i < n; i++)
+        ready[i] = events[i].data.ptr;
+    return n;
+}
+#else
+static struct pollfd *ev_fds = NULL;
+static void **ev_ptrs = NULL;
+static int ev_count = 0, ev_cap = 0;
+
+static bool ev_init(void)
+{
+    ev_count = 0;
+    return true;
+}
+
+static bool ev_add(int fd, void *ptr)
+{
+    if (ev_count == ev_cap) {
+        int cap = ev_cap ? 2 * ev_cap : 16;
+        struct pollfd *fds = realloc(ev_fds, cap * sizeof(struct pollfd));
+        if (!fds)
+            return false;
+        ev_fds = fds;
+        void **ptrs = realloc(ev_ptrs, cap * sizeof(void *));
+        if (!ptrs)
+            return false;
+        ev_ptrs = ptrs;
+        ev_cap = cap;
+    }
+    ev_fds[ev_count] = (struct pollfd){.fd = fd, .events = POLLIN};
+    ev_ptrs[ev_count++] = ptr;
+    return true;
+}
+
+static void ev_del(int fd)
+{
+    for (int i = 0; i < ev_count; i++) {
+        if (ev_fds[i].fd == fd) {
+            ev_fds[i] = ev_fds[--ev_count];
+            ev_ptrs[i] = ev_ptrs[ev_count];
+            return;
+        }
+    }
+}
+
+static void ev_close(void)
+{
+    ev_count = 0;
+}
+
+static int ev_wait(void **ready, int max)
+{
+    int n = poll(ev_fds, ev_count, -1);
+    if (n <= 0)
+        return n;
+    n = 0;
+    for (int i = 0; i < ev_count && n < max; i++)
+        if (ev_fds[i].revents)
+            ready[n++] = ev_ptrs[i];
+    return n;
+}
+#endif
+
+/* Leave the event loop to the console, e.g. in a forked process */
+static void backend_close(void)
+{
+    ev_close();
+    if (use_uring) {
+        uring_exit();
+        use_uring = false;
     }
+}
 
-    /* Copy min(n, rp->count) bytes from internal buf to user buf */
-    cnt = n;
-    if (rp->count < n)
-        cnt = rp->count;
-    memcpy(usrbuf, rp->bufptr, cnt);
-    rp->bufptr += cnt;
-    rp->count -= cnt;
-    return cnt;
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+/* Write all n bytes.  Sockets are non-blocking, so wait (for a bounded
+ * time) until the peer drains its receive window when it fills up.
+ */
 static ssize_t writen(int fd, void *usrbuf, size_t n)
 {
     size_t nleft = n;
     char *bufp = usrbuf;
 
     while (nleft > 0) {
-        ssize_t nwritten = write(fd, bufp, nleft);
+        ssize_t nwritten = send(fd, bufp, nleft, MSG_NOSIGNAL);
         if (nwritten <= 0) {
             if (errno == EINTR) { /* interrupted by sig handler return */
                 nwritten = 0;     /* and call write() again */
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+                if (poll(&pfd, 1, SEND_TIMEOUT) <= 0)
+                    return -1;
+                nwritten = 0;
             } else
                 return -1; /* errorno set by write() */
         }
@@ -95,35 +276,38 @@ static ssize_t writen(int fd, void *usrbuf, size_t n)
     return n;
 }
 
-/* robustly read a text line (buffered) */
-static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+/* Write out the iovcnt buffers of iov, in a single system call as long as
+ * the socket has room.  Return -1 on error.
+ */
+static int sendv(int fd, struct iovec *iov, int iovcnt)
 {
-    char c, *bufp = usrbuf;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
 
-    int n;
-    for (n = 1; n < maxlen; n++) {
-        int rc;
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n')
-                break;
-        } else if (rc == 0) {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            break;        /* EOF, some data was read */
-        } else
-            return -1; /* error */
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n == (ssize_t) total)
+        return 0;
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+        n = 0;
     }
-    *bufp = 0;
-    return n;
-}
-
-void web_send(int out_fd, char *buf)
-{
-    writen(out_fd, buf, strlen(buf));
+    /* Short write: push the remainder out piecewise */
+    for (int i = 0; i < iovcnt; i++) {
+        if ((size_t) n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            continue;
+        }
+        if (writen(fd, (char *) iov[i].iov_base + n, iov[i].iov_len - n) < 0)
+            return -1;
+        n = 0;
+    }
+    return 0;
 }
 
-int web_open(int port)
+int web_open(int port, bool uring)
 {
     int listenfd, optval = 1;
     struct sockaddr_in serveraddr;
@@ -137,12 +321,6 @@ int web_open(int port)
                    sizeof(int)) < 0)
         return -1;
 
-    // 6 is TCP's protocol number
-    // enable this, much faster : 4000 req/s -> 17000 req/s
-    if (setsockopt(listenfd, IPPROTO_TCP, TCP_CORK, (const void *) &optval,
-                   sizeof(int)) < 0)
-        return -1;
-
     /* Listenfd will be an endpoint for all requests to port
        on any IP address for this host */
     memset(&serveraddr, 0, sizeof(serveraddr));
@@ -156,115 +334,791 @@ int web_open(int port)
     if (listen(listenfd, LISTENQ) < 0)
         return -1;
 
+    /* Accept and read without ever blocking the console */
+    if (set_nonblocking(listenfd) < 0)
+        return -1;
+
+    use_uring = uring && uring_init(URING_ENTRIES, URING_NBUFS, URING_BUFSIZE);
+    if (use_uring) {
+        server_fd = listenfd;
+        uring_prep_accept_multishot(listenfd, URING_ACCEPT);
+        return listenfd;
+    }
+
+    if (!ev_init() || !ev_add(listenfd, &server_tag))
+        return -1;
+
+    /* Keystrokes interrupt the wait as well.  This fails harmlessly when
+     * stdin is not something that can be polled.
+     */
+    ev_add(STDIN_FILENO, &stdin_tag);
+
     server_fd = listenfd;
 
     return listenfd;
 }
 
-static void url_decode(char *src, char *dest, int max)
+bool web_uring(void)
+{
+    return use_uring;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Percent-decode the len bytes at src into dest, which holds max bytes */
+static void url_decode(const char *src, size_t len, char *dest, size_t max)
 {
-    char *p = src;
-    char code[3] = {0};
-    while (*p && --max) {
-        if (*p == '%') {
-            memcpy(code, ++p, 2);
-            *dest++ = (char) strtoul(code, NULL, 16);
-            p += 2;
+    const char *end = src + len;
+    while (src < end && --max) {
+        int hi, lo;
+        if (*src == '%' && end - src >= 3 && (hi = hex_value(src[1])) >= 0 &&
+            (lo = hex_value(src[2])) >= 0) {
+            *dest++ = (char) (hi << 4 | lo);
+            src += 3;
         } else {
-            *dest++ = *p++;
+            *dest++ = *src++;
         }
     }
     *dest = '\0';
 }
 
-static void parse_request(int fd, http_request_t *req)
-{
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE];
-    req->offset = 0;
-    req->end = 0; /* default */
-
-    rio_readinitb(&rio, fd);
-    rio_readlineb(&rio, buf, MAXLINE);
-    sscanf(buf, "%1023s %1023s", method, uri); /* version is not cared */
-    /* read all */
-    while (buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
-        rio_readlineb(&rio, buf, MAXLINE);
-        if (buf[0] == 'R' && buf[1] == 'a' && buf[2] == 'n') {
-            sscanf(buf, "Range: bytes=%lu-%lu", (unsigned long *) &req->offset,
-                   (unsigned long *) &req->end);
-            /* Range: [start, end] */
-            if (req->end != 0)
-                req->end++;
+static uint64_t uring_data(web_conn_t *conn, int op)
+{
+    return (uintptr_t) conn | op;
+}
+
+/* Receive more once what has arrived fits into the buffer */
+static void uring_arm_recv(web_conn_t *conn)
+{
+    if (conn->recv_armed || conn->eof || conn->closing || conn->held >= 0 ||
+        conn->len == sizeof(conn->buf))
+        return;
+    if (uring_prep_recv(conn->fd, uring_data(conn, URING_RECV))) {
+        conn->recv_armed = true;
+        conn->pending++;
+    } else {
+        conn->eof = true;
+    }
+}
+
+/* Move held data into the buffer as far as there is room */
+static void uring_pull(web_conn_t *conn)
+{
+    if (conn->held >= 0) {
+        size_t n = sizeof(conn->buf) - conn->len;
+        if (n > conn->held_len)
+            n = conn->held_len;
+        memcpy(conn->buf + conn->len, uring_buffer(conn->held) + conn->held_off,
+               n);
+        conn->len += n;
+        conn->held_off += n;
+        conn->held_len -= n;
+        if (!conn->held_len) {
+            uring_recycle(conn->held);
+            conn->held = -1;
         }
     }
-    char *filename = uri;
-    if (uri[0] == '/') {
-        filename = uri + 1;
-        int length = strlen(filename);
-        if (length == 0) {
-            filename = ".";
+    uring_arm_recv(conn);
+}
+
+static void uring_close_now(web_conn_t *conn)
+{
+    if (conn->close_armed || conn->closed)
+        return;
+    if (uring_prep_close(conn->fd, uring_data(conn, URING_CLOSE))) {
+        conn->close_armed = true;
+        conn->pending++;
+    } else {
+        close(conn->fd);
+        conn->closed = true;
+    }
+}
+
+static void uring_send_done(web_conn_t *conn, int res);
+
+/* Send the first queued response.  The last one before closing takes the
+ * close along in a linked request, or else the close follows its completion.
+ */
+static void uring_send(web_conn_t *conn)
+{
+    web_out_t *out = conn->out;
+    out->linked = conn->closing && !out->next && !conn->close_armed &&
+                  uring_prep_sendmsg_close(conn->fd, &out->msg,
+                                           uring_data(conn, URING_SEND),
+                                           uring_data(conn, URING_CLOSE));
+    if (out->linked) {
+        conn->close_armed = true;
+        conn->pending += 2;
+        return;
+    }
+    if (!uring_prep_sendmsg(conn->fd, &out->msg,
+                            uring_data(conn, URING_SEND))) {
+        /* Out of queue entries: send this response the plain way */
+        size_t len = 0;
+        for (size_t i = 0; i < out->msg.msg_iovlen; i++)
+            len += out->msg.msg_iov[i].iov_len;
+        int ret = sendv(conn->fd, out->msg.msg_iov, out->msg.msg_iovlen);
+        uring_send_done(conn, ret < 0 ? -EIO : (int) len);
+        return;
+    }
+    conn->pending++;
+}
+
+static void out_free(web_out_t *out)
+{
+    /* Keep the memory for the next response */
+    if (!response.data && out->size <= RESPONSE_KEEP) {
+        response.data = out->data;
+        response.size = out->size;
+    } else {
+        free(out->data);
+    }
+    free(out);
+}
+
+/* Skip the n bytes sent.  Return false when nothing is left */
+static bool out_advance(web_out_t *out, size_t n)
+{
+    struct iovec *iov = out->msg.msg_iov;
+    size_t cnt = out->msg.msg_iovlen;
+    for (; cnt && n >= iov->iov_len; iov++, cnt--)
+        n -= iov->iov_len;
+    if (cnt) {
+        iov->iov_base = (char *) iov->iov_base + n;
+        iov->iov_len -= n;
+    }
+    out->msg.msg_iov = iov;
+    out->msg.msg_iovlen = cnt;
+    return cnt > 0;
+}
+
+/* Stop receiving, and close once the responses are out */
+static void uring_close(web_conn_t *conn)
+{
+    conn->closing = true;
+    if (conn->held >= 0) {
+        uring_recycle(conn->held);
+        conn->held = -1;
+    }
+    if (conn->recv_armed)
+        uring_prep_cancel(uring_data(conn, URING_RECV),
+                          uring_data(NULL, URING_IGNORE));
+    if (!conn->out)
+        uring_close_now(conn);
+}
+
+static void uring_send_done(web_conn_t *conn, int res)
+{
+    web_out_t *out = conn->out;
+    if (res < 0 || conn->closed) {
+        /* The client is gone: drop the responses */
+        while (conn->out) {
+            out = conn->out;
+            conn->out = out->next;
+            out_free(out);
+        }
+        conn->eof = true;
+        uring_close(conn);
+        return;
+    }
+
+    /* A short linked send, being MSG_WAITALL, cancels the close: that is
+     * taken care of when its completion arrives
+     */
+    if (out_advance(out, res)) {
+        uring_send(conn);
+        return;
+    }
+    conn->out = out->next;
+    out_free(out);
+    if (conn->out)
+        uring_send(conn);
+    else if (conn->closing)
+        uring_close_now(conn);
+}
+
+/* Free the connection once nothing refers to it any more */
+static void uring_release(web_conn_t *conn)
+{
+    if (!conn->closed || conn->pending || conn->queued || conn == active)
+        return;
+    while (conn->out) {
+        web_out_t *out = conn->out;
+        conn->out = out->next;
+        out_free(out);
+    }
+    free(conn);
+}
+
+/* Queue the response, which leaves behind a fresh response sink */
+static void uring_respond(web_conn_t *conn, const char *header, size_t len)
+{
+    web_out_t *out = malloc(sizeof(web_out_t));
+    if (!out) {
+        uring_close(conn);
+        return;
+    }
+    memcpy(out->header, header, len);
+    out->iov[0] = (struct iovec){.iov_base = out->header, .iov_len = len};
+    out->iov[1] =
+        (struct iovec){.iov_base = response.data, .iov_len = response.len};
+    out->msg = (struct msghdr){.msg_iov = out->iov, .msg_iovlen = 2};
+    out->data = response.data;
+    out->size = response.size;
+    out->next = NULL;
+    response = (report_sink_t){0};
+
+    if (conn->close_armed || conn->closed) {
+        out_free(out);
+        return;
+    }
+    web_out_t **tail = &conn->out;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = out;
+    if (!conn->keep_alive)
+        uring_close(conn);
+    if (conn->out == out)
+        uring_send(conn);
+}
+
+static void conn_close(web_conn_t *conn)
+{
+    if (use_uring) {
+        uring_close(conn);
+        return;
+    }
+    if (!conn->eof)
+        ev_del(conn->fd);
+    close(conn->fd);
+    free(conn);
+}
+
+/* Status line refusing a request the parser did not accept */
+static char *reject_status(http_parse_status_t status)
+{
+    switch (status) {
+    case HTTP_PARSE_BAD:
+        return "400 Bad Request";
+    case HTTP_PARSE_URI_TOO_LONG:
+        return "414 URI Too Long";
+    case HTTP_PARSE_HEAD_TOO_LONG:
+        return "431 Request Header Fields Too Large";
+    default:
+        return NULL;
+    }
+}
+
+/* Answer a request that cannot be served, and give up on the connection */
+static void conn_reject(web_conn_t *conn, char *status)
+{
+    char response[128];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+             status);
+    writen(conn->fd, response, strlen(response));
+
+    /* Closing with unread input would reset the connection and might
+     * destroy the response, so discard what has arrived so far (within
+     * reason: the client may still be sending).
+     */
+    shutdown(conn->fd, SHUT_WR);
+    for (int i = 0; i < 16 && !conn->eof; i++)
+        if (read(conn->fd, conn->buf, sizeof(conn->buf)) <= 0)
+            break;
+    conn_close(conn);
+}
+
+static void conn_enqueue(web_conn_t *conn)
+{
+    conn->queued = true;
+    conn->next = NULL;
+    if (ready_tail)
+        ready_tail->next = conn;
+    else
+        ready_head = conn;
+    ready_tail = conn;
+}
+
+/* Queue the connection if it holds a complete request.  Requests that are
+ * malformed or too large are refused as soon as that shows.
+ */
+static void conn_update(web_conn_t *conn)
+{
+    if (use_uring)
+        uring_pull(conn);
+    if (conn->queued || conn == active)
+        return;
+    http_parse_status_t status = http_parse_request(
+        conn->buf, conn->len, sizeof(conn->buf), &conn->req);
+    if (status == HTTP_PARSE_OK)
+        conn_enqueue(conn);
+    else if (status != HTTP_PARSE_INCOMPLETE)
+        conn_reject(conn, reject_status(status));
+    else if (conn->eof)
+        conn_close(conn);
+}
+
+/* Read whatever the client has sent, without blocking */
+static void conn_fill(web_conn_t *conn)
+{
+    while (!conn->eof && conn->len < sizeof(conn->buf)) {
+        ssize_t n = read(conn->fd, conn->buf + conn->len,
+                         sizeof(conn->buf) - conn->len);
+        if (n > 0) {
+            conn->len += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
         } else {
-            for (int i = 0; i < length; ++i) {
-                if (filename[i] == '?') {
-                    filename[i] = '\0';
-                    break;
-                }
-            }
+            /* EOF or error.  Requests already buffered are still served */
+            conn->eof = true;
         }
     }
-    url_decode(filename, req->filename, MAXLINE);
 }
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr)
+static void conn_read(web_conn_t *conn)
 {
-    http_request_t req;
-    parse_request(fd, &req);
+    conn_fill(conn);
+    if (conn->eof)
+        ev_del(conn->fd);
+    conn_update(conn);
+}
+
+static web_conn_t *conn_new(int fd)
+{
+    static unsigned long serial = 0;
 
-    char *p = req.filename;
-    /* Change '/' to ' ' */
-    while (*p) {
-        ++p;
+    web_conn_t *conn = malloc(sizeof(web_conn_t));
+    if (!conn || set_nonblocking(fd) < 0) {
+        free(conn);
+        close(fd);
+        return NULL;
+    }
+    /* Each response leaves in one piece once complete; Nagle would hold
+     * back pipelined responses waiting for the client's delayed ACKs.
+     */
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    conn->fd = fd;
+    conn->id = ++serial;
+    conn->eof = false;
+    conn->queued = false;
+    conn->keep_alive = false;
+    conn->len = 0;
+    conn->next = NULL;
+    conn->pending = 0;
+    conn->recv_armed = false;
+    conn->closing = false;
+    conn->close_armed = false;
+    conn->closed = false;
+    conn->held = -1;
+    conn->out = NULL;
+    return conn;
+}
+
+static void web_accept(void)
+{
+    while (1) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break; /* EAGAIN: no more pending connections */
+        }
+
+        web_conn_t *conn = conn_new(fd);
+        if (!conn)
+            continue;
+        if (!ev_add(fd, conn)) {
+            conn_close(conn);
+            continue;
+        }
+
+        /* The request often arrives together with the connection */
+        conn_read(conn);
+    }
+}
+
+/* Turn the parsed request at the start of the connection buffer into a
+ * command line in buf and send the response header.  The connection becomes
+ * the active one: command output goes to it until the response is finished.
+ */
+static void start_response(web_conn_t *conn, char *buf)
+{
+    /* The path is the command, with its arguments separated by '/' */
+    http_request_t *req = &conn->req;
+    const char *target = req->target.ptr;
+    size_t len = req->target.len;
+    if (*target == '/') {
+        target++;
+        len--;
+    }
+    const char *query = memchr(target, '?', len);
+    if (query)
+        len = query - target;
+    if (len)
+        url_decode(target, len, buf, MAXLINE);
+    else
+        strcpy(buf, ".");
+    for (char *p = buf; *p; p++)
         if (*p == '/')
             *p = ' ';
+
+    /* The request has been consumed; pipelined ones move up */
+    bool keep_alive = req->keep_alive;
+    conn->len -= req->head_len;
+    memmove(conn->buf, conn->buf + req->head_len, conn->len);
+
+    /* Collect the output, to be sent with the header once complete */
+    conn->keep_alive = keep_alive;
+    active = conn;
+    response.len = 0;
+    report_set_sink(&response);
+}
+
+/* Take the next request off the ready queue and turn it into a command line
+ * in buf.  The connection becomes the active one until web_done().
+ * Return length of the command, or -1 if there is nothing to run.
+ */
+static int web_dispatch(char *buf)
+{
+    web_conn_t *conn = ready_head;
+    ready_head = conn->next;
+    if (!ready_head)
+        ready_tail = NULL;
+    conn->queued = false;
+
+    start_response(conn, buf);
+    if (!buf[0]) {
+        /* Returning 0 would make linenoise wait for a keystroke */
+        web_done();
+        return -1;
+    }
+    return strlen(buf);
+}
+
+/* Send the response of the active connection.  Return false when the
+ * connection has been closed.
+ */
+static bool finish_response(web_conn_t *conn)
+{
+    report_set_sink(NULL);
+    active = NULL;
+
+    char header[128];
+    struct iovec iov[2] = {
+        {.iov_base = header,
+         .iov_len = snprintf(header, sizeof(header),
+                             "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                             "Content-Length: %zu\r\n%s\r\n",
+                             response.len,
+                             conn->keep_alive ? "" : "Connection: close\r\n")},
+        {.iov_base = response.data, .iov_len = response.len},
+    };
+    if (use_uring) {
+        uring_respond(conn, header, iov[0].iov_len);
+        bool open = !conn->closing;
+        uring_release(conn);
+        return open;
+    }
+    int ret = sendv(conn->fd, iov, 2);
+
+    /* Do not hold on to the memory of an exceptionally large response */
+    if (response.size > RESPONSE_KEEP) {
+        free(response.data);
+        response = (report_sink_t){0};
+    }
+
+    if (ret < 0 || !conn->keep_alive) {
+        conn_close(conn);
+        return false;
+    }
+    return true;
+}
+
+unsigned long web_client(void)
+{
+    return active ? active->id : 0;
+}
+
+void web_done(void)
+{
+    web_conn_t *conn = active;
+    /* Serve the next pipelined request, or wait for more input */
+    if (conn && finish_response(conn))
+        conn_update(conn);
+}
+
+/* Wait for readiness and act on it.  Return -1 on error */
+static int ev_events(bool *stdin_ready)
+{
+    void *ready[MAX_EVENTS];
+    int n = ev_wait(ready, MAX_EVENTS);
+    for (int i = 0; i < n; i++) {
+        if (ready[i] == &stdin_tag)
+            *stdin_ready = true;
+        else if (ready[i] == &server_tag)
+            web_accept();
+        else
+            conn_read(ready[i]);
     }
-    char *ret = malloc(strlen(req.filename) + 1);
-    strncpy(ret, req.filename, strlen(req.filename) + 1);
+    return n < 0 ? -1 : 0;
+}
 
-    return ret;
+/* Wait for io_uring completions and act on them.  Return -1 on error */
+static int uring_events(bool *stdin_ready)
+{
+    bool stdin_new = false;
+    if (!stdin_armed)
+        stdin_armed = stdin_new = uring_prep_poll(STDIN_FILENO, URING_STDIN);
+
+    uring_cqe_t cqes[MAX_EVENTS];
+    int n = uring_wait(cqes, MAX_EVENTS);
+    for (int i = 0; i < n; i++) {
+        uring_cqe_t *cqe = &cqes[i];
+        web_conn_t *conn =
+            (web_conn_t *) (uintptr_t) (cqe->user_data & ~URING_OP_MASK);
+        switch (cqe->user_data & URING_OP_MASK) {
+        case URING_ACCEPT:
+            if (cqe->res >= 0 && (conn = conn_new(cqe->res)))
+                uring_arm_recv(conn);
+            if (!cqe->more)
+                uring_prep_accept_multishot(server_fd, URING_ACCEPT);
+            continue;
+        case URING_STDIN:
+            /* A change of terminal modes fails the poll in flight, so poll
+             * again.  Like epoll, ignore stdin if it cannot be polled at all.
+             */
+            stdin_armed = cqe->res < 0 && stdin_new;
+            if (cqe->res >= 0)
+                *stdin_ready = true;
+            continue;
+        case URING_IGNORE:
+            continue;
+        case URING_RECV:
+            conn->pending--;
+            conn->recv_armed = false;
+            if (cqe->bid >= 0 && cqe->res > 0 && !conn->closing) {
+                conn->held = cqe->bid;
+                conn->held_off = 0;
+                conn->held_len = cqe->res;
+            } else if (cqe->bid >= 0) {
+                uring_recycle(cqe->bid);
+            }
+            /* Out of buffers is no reason to give up on the client */
+            if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS))
+                conn->eof = true;
+            if (!conn->closing)
+                conn_update(conn);
+            break;
+        case URING_SEND:
+            conn->pending--;
+            uring_send_done(conn, cqe->res);
+            break;
+        case URING_CLOSE:
+            conn->pending--;
+            conn->close_armed = false;
+            /* Cancelled along with a short send: close after the rest */
+            if (cqe->res != -ECANCELED)
+                conn->closed = true;
+            else if (!conn->out)
+                uring_close_now(conn);
+            break;
+        }
+        uring_release(conn);
+    }
+    return n < 0 ? -1 : 0;
 }
 
 int web_eventmux(char *buf)
 {
-    fd_set listenset;
+    /* Finish a response still open, e.g. when the command line was empty */
+    web_done();
+
+    while (1) {
+        while (ready_head) {
+            int len = web_dispatch(buf);
+            if (len >= 0)
+                return len;
+        }
+
+        bool stdin_ready = false;
+        int ret =
+            use_uring ? uring_events(&stdin_ready) : ev_events(&stdin_ready);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
 
-    FD_ZERO(&listenset);
-    FD_SET(STDIN_FILENO, &listenset);
-    int max_fd = STDIN_FILENO;
-    if (server_fd > 0) {
-        FD_SET(server_fd, &listenset);
-        max_fd = max_fd > server_fd ? max_fd : server_fd;
+        /* Web requests go first; keystrokes are read once they are served */
+        if (stdin_ready && !ready_head)
+            return 0;
     }
-    int result = select(max_fd + 1, &listenset, NULL, NULL, NULL);
-    if (result < 0)
-        return -1;
+}
 
-    if (server_fd > 0 && FD_ISSET(server_fd, &listenset)) {
-        FD_CLR(server_fd, &listenset);
-        struct sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        int web_connfd =
-            accept(server_fd, (struct sockaddr *) &clientaddr, &clientlen);
+/* Serve the requests of one session, a connection, in a worker.  Return
+ * false if the worker is to terminate.
+ */
+static bool worker_session(web_conn_t *conn, const web_worker_ops_t *ops)
+{
+    char cmdline[MAXLINE];
+    while (1) {
+        http_parse_status_t status = http_parse_request(
+            conn->buf, conn->len, sizeof(conn->buf), &conn->req);
+        if (status == HTTP_PARSE_INCOMPLETE) {
+            struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+            if (conn->eof || poll(&pfd, 1, IDLE_TIMEOUT) <= 0) {
+                conn_close(conn);
+                return true;
+            }
+            conn_fill(conn);
+            continue;
+        }
+        if (status != HTTP_PARSE_OK) {
+            conn_reject(conn, reject_status(status));
+            return true;
+        }
 
-        char *p = web_recv(web_connfd, &clientaddr);
-        char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-        web_send(web_connfd, buffer);
-        strncpy(buf, p, strlen(p) + 1);
-        free(p);
-        close(web_connfd);
-        return strlen(buf);
+        start_response(conn, cmdline);
+        bool more = !cmdline[0] || ops->run(cmdline);
+        if (!finish_response(conn) || !more)
+            return more;
     }
+}
 
-    FD_CLR(STDIN_FILENO, &listenset);
-    return 0;
+static void worker_main(const web_worker_ops_t *ops)
+{
+#if defined(__linux__)
+    /* Do not outlive the console */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+    /* Connections are served one at a time; stdin belongs to the console */
+    backend_close();
+    if (ops->init)
+        ops->init();
+
+    while (1) {
+        struct pollfd pfd = {.fd = server_fd, .events = POLLIN};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            break;
+        /* Other workers may have been faster */
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        web_conn_t *conn = conn_new(fd);
+        if (!conn)
+            continue;
+        bool more = worker_session(conn, ops);
+        if (ops->reset)
+            ops->reset();
+        if (!more)
+            break;
+    }
+
+    /* Leave without running exit handlers: they belong to the console */
+    fflush(NULL);
+    report_flush();
+    _exit(0);
+}
+
+static pid_t spawn_worker(const web_worker_ops_t *ops)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* The supervisor's handlers would act on stale worker ids */
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        worker_main(ops);
+    }
+    return pid;
+}
+
+static void supervisor_sigterm(int sig)
+{
+    for (int i = 0; i < n_workers; i++)
+        if (workers[i] > 0)
+            kill(workers[i], SIGTERM);
+    for (int i = 0; i < n_workers; i++)
+        if (workers[i] > 0)
+            waitpid(workers[i], NULL, 0);
+    _exit(0);
+}
+
+/* Keep the pool at full strength: a worker that crashed, or was told to quit
+ * by its client, is replaced by a fresh copy.
+ */
+static void supervisor_main(const web_worker_ops_t *ops)
+{
+#if defined(__linux__)
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+    signal(SIGTERM, supervisor_sigterm);
+    signal(SIGINT, supervisor_sigterm);
+    backend_close();
+
+    for (int i = 0; i < n_workers; i++)
+        workers[i] = spawn_worker(ops);
+
+    while (1) {
+        pid_t pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i = 0; i < n_workers; i++) {
+            if (workers[i] == pid) {
+                sleep(1); /* Do not spin if workers die right away */
+                workers[i] = spawn_worker(ops);
+            }
+        }
+    }
+    _exit(1);
+}
+
+int web_pool_start(int nworkers, const web_worker_ops_t *ops)
+{
+    workers = calloc(nworkers, sizeof(pid_t));
+    if (!workers)
+        return 0;
+    n_workers = nworkers;
+
+    /* Output buffered so far must not be written by every process */
+    fflush(NULL);
+    report_flush();
+    supervisor = fork();
+    if (supervisor == 0)
+        supervisor_main(ops);
+
+    /* Only the workers accept connections */
+    backend_close();
+    close(server_fd);
+    free(workers);
+    workers = NULL;
+    if (supervisor < 0) {
+        supervisor = 0;
+        return 0;
+    }
+    return nworkers;
+}
+
+void web_pool_stop(void)
+{
+    if (!supervisor)
+        return;
+    kill(supervisor, SIGTERM);
+    waitpid(supervisor, NULL, 0);
+    supervisor = 0;
 }
@@ -2,13 +2,48 @@
 #define TINYWEB_H
 
 #include <netinet/in.h>
+#include <stdbool.h>
 
-int web_open(int port);
+/* Listen on port.  With uring set, clients are served through io_uring if
+ * the kernel supports it, and through epoll (or poll) otherwise.
+ */
+int web_open(int port, bool uring);
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr);
-
-void web_send(int out_fd, char *buffer);
+/* Whether clients are served through io_uring */
+bool web_uring(void);
 
+/* Wait for either a keystroke or a complete web request.  Client connections
+ * are served concurrently by a non-blocking event loop.  When a request is
+ * ready, its command line is copied into buf and its length returned; the
+ * command output is then collected and sent to that client by web_done().
+ * Return 0 when stdin is readable, -1 on error.
+ */
 int web_eventmux(char *buf);
 
+/* Client connection whose request is being executed, as a number never
+ * given to another one, or 0 if the command did not come from the web
+ */
+unsigned long web_client(void);
+
+/* Finish the response of the request being executed, if any */
+void web_done(void);
+
+/* Hooks run in the worker processes of a pool */
+typedef struct {
+    void (*init)(void);         /* Once, when the worker starts */
+    bool (*run)(char *cmdline); /* Execute a command; false stops the worker */
+    void (*reset)(void);        /* Drop the state left by a finished session */
+} web_worker_ops_t;
+
+/* Serve web sessions by a pool of worker processes instead of the console.
+ * Each worker handles one connection at a time, whose requests all run in
+ * that worker, so sessions keep state of their own and run in parallel.
+ * The listening socket is handed over to the workers.  Return the number of
+ * workers started.
+ */
+int web_pool_start(int nworkers, const web_worker_ops_t *ops);
+
+/* Terminate the workers and wait for them */
+void web_pool_stop(void);
+
 #endif
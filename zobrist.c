@@ -4,7 +4,7 @@
 #include "mt19937-64.h"
 #include "zobrist.h"
 
-uint64_t zobrist_table[N_GRIDS][2];
+uint64_t zobrist_table[MAX_GRIDS][2];
 
 #define HASH(key) ((key) % HASH_TABLE_SIZE)
 
@@ -13,7 +13,7 @@ static struct hlist_head *hash_table;
 void zobrist_init(void)
 {
     int i;
-    for (i = 0; i < N_GRIDS; i++) {
+    for (i = 0; i < MAX_GRIDS; i++) {
         zobrist_table[i][0] = mt19937_rand();
         zobrist_table[i][1] = mt19937_rand();
     }
@@ -7,7 +7,7 @@
 
 #define HASH_TABLE_SIZE ((int) 1e6 + 3)  // choose a large prime number
 
-extern uint64_t zobrist_table[N_GRIDS][2];
+extern uint64_t zobrist_table[MAX_GRIDS][2];
 
 typedef struct {
     uint64_t key;